@@ -33,6 +33,9 @@ namespace dae
 		const float near = 0.1f;
 		const float far = 100.0f;
 
+		// Set whenever the view moves, the renderer clears it after rebuilding what depends on the camera
+		bool hasChanged{ true };
+
 		Matrix invViewMatrix{};
 		Matrix viewMatrix{};
 		Matrix projectionMatrix{};
@@ -48,6 +51,7 @@ namespace dae
 			fov = tanf((fovAngle * TO_RADIANS) / 2.f);
 
 			origin = _origin;
+			hasChanged = true;
 		}
 
 		void CalculateViewMatrix()
@@ -79,32 +83,40 @@ namespace dae
 			if (pKeyboardState[SDL_SCANCODE_W])
 			{
 				origin += forward * camVelocity * deltaTime;
+				hasChanged = true;
 			}
 			if (pKeyboardState[SDL_SCANCODE_S])
 			{
 				origin -= forward * camVelocity * deltaTime;
+				hasChanged = true;
 			}
 			if (pKeyboardState[SDL_SCANCODE_A])
 			{
 				origin -= right * camVelocity * deltaTime;
+				hasChanged = true;
 			}
 			if (pKeyboardState[SDL_SCANCODE_D])
 			{
 				origin += right * camVelocity * deltaTime;
+				hasChanged = true;
 			}
 
 			// Rotate logic
-			if (mouseState & SDL_BUTTON_RMASK)
+			if (mouseState & SDL_BUTTON_RMASK && (mouseX != 0 || mouseY != 0))
 			{
 				totalPitch -= mouseY * angleVelocity * deltaTime;
 				totalYaw += mouseX * angleVelocity * deltaTime;
 
 				forward = Matrix::CreateRotation(totalPitch, totalYaw, 0.0f).TransformVector(Vector3::UnitZ);
+				hasChanged = true;
 			}
 
 			//Update Matrices
-			CalculateViewMatrix();
-			CalculateProjectionMatrix(); //Try to optimize this - should only be called once or when fov/aspectRatio changes
+			if (hasChanged)
+			{
+				CalculateViewMatrix();
+				CalculateProjectionMatrix();
+			}
 		}
 	};
 }
@@ -1,9 +1,14 @@
 #pragma once
 #include "Math.h"
+#include "Packet.h"
 #include "vector"
+#include <memory>
+#include <span>
 
 namespace dae
 {
+	class MappedFile;
+
 	struct Vertex
 	{
 		Vector3 position{};
@@ -24,19 +29,131 @@ namespace dae
 		//Vector3 viewDirection{};
 	};
 
+	// 8 horizontally adjacent fragments of one triangle, lanes outside the mask are don't care
+	struct FragmentPacket
+	{
+		Vector2Packet position{};
+		Vector2Packet uv{};
+		// Screen space derivatives of the UVs, one pixel step in x and in y
+		Vector2Packet uvDdx{};
+		Vector2Packet uvDdy{};
+		Vector3Packet normal{};
+		Vector3Packet tangent{};
+		// Normalized camera to fragment direction
+		Vector3Packet viewDirection{};
+		// View space depth
+		__m256 depth{};
+		__m256 mask{};
+	};
+
+	// 18 byte vertex: octahedral normal/tangent as two snorm16, position quantized
+	// to 16 bits inside the mesh bounds and half float UVs
+#pragma pack(push, 2)
+	struct PackedVertex
+	{
+		uint32_t normal{};
+		uint32_t tangent{};
+		uint16_t position[3]{};
+		uint16_t uv[2]{};
+	};
+#pragma pack(pop)
+
+	struct PackedVertexStream
+	{
+		std::vector<PackedVertex> vertices{};
+		// RGBA8, left empty when every vertex is white
+		std::vector<uint32_t> colors{};
+	};
+
+	// A PackedVertexStream wherever its vertices are stored
+	struct PackedVertexView
+	{
+		std::span<const PackedVertex> vertices{};
+		std::span<const uint32_t> colors{};
+	};
+
+	// The streams of one level read straight out of a mapped mesh cache file
+	struct MappedMeshLevel
+	{
+		std::span<const Vertex> vertices{};
+		std::span<const uint32_t> indices{};
+		PackedVertexView packedVertices{};
+	};
+
 	enum class PrimitiveTopology
 	{
 		TriangleList,
 		TriangleStrip
 	};
 
+	struct MeshLOD
+	{
+		std::vector<Vertex> vertices{};
+		std::vector<uint32_t> indices{};
+		PackedVertexStream packedVertices{};
+		// Largest object space deviation introduced to reach this level
+		float error{};
+	};
+
 	struct Mesh
 	{
 		std::vector<Vertex> vertices{};
 		std::vector<uint32_t> indices{};
 		PrimitiveTopology primitiveTopology{ PrimitiveTopology::TriangleStrip };
+		// Index into the renderer's materials
+		uint32_t materialIndex{};
+
+		// Coarser levels of detail, lods[0] is LOD 1. A mapped mesh only keeps their errors here
+		std::vector<MeshLOD> lods{};
+
+		// Also the quantization range of the packed positions
+		Vector3 minBounds{};
+		Vector3 maxBounds{};
+
+		// Once packed, the float vertices of every level are freed and this is what gets drawn
+		PackedVertexStream packedVertices{};
+
+		// Set when the mesh was loaded from a cache file. Every level then reads from the mapping and the
+		// vectors above stay empty
+		std::shared_ptr<const MappedFile> pMapping{};
+		std::vector<MappedMeshLevel> mappedLevels{};
+
+		std::span<const Vertex> GetVertices(uint32_t lodIndex) const
+		{
+			if (pMapping)
+				return mappedLevels[lodIndex].vertices;
 
-		std::vector<Vertex_Out> vertices_out{};
+			return lodIndex == 0 ? vertices : lods[lodIndex - 1].vertices;
+		}
+
+		std::span<const uint32_t> GetIndices(uint32_t lodIndex) const
+		{
+			if (pMapping)
+				return mappedLevels[lodIndex].indices;
+
+			return lodIndex == 0 ? indices : lods[lodIndex - 1].indices;
+		}
+
+		PackedVertexView GetPackedVertices(uint32_t lodIndex) const
+		{
+			if (pMapping)
+				return mappedLevels[lodIndex].packedVertices;
+
+			const PackedVertexStream& stream = lodIndex == 0 ? packedVertices : lods[lodIndex - 1].packedVertices;
+			return { stream.vertices, stream.colors };
+		}
+
+		bool IsPacked() const
+		{
+			return !GetPackedVertices(0).vertices.empty();
+		}
+	};
+
+	// One placement of a shared Mesh, the LOD is kept per instance for hysteresis
+	struct MeshInstance
+	{
 		Matrix worldMatrix{};
+		uint32_t lodIndex{};
+		uint32_t meshIndex{};
 	};
-}
\ No newline at end of file
+}
@@ -0,0 +1,182 @@
+#include "FastPow.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+
+namespace dae
+{
+	PowTable::PowTable(float maxExponent) :
+		m_MaxExponent{ maxExponent },
+		m_Values(ExponentSteps * (BaseSteps + 1))
+	{
+		for (int e{}; e < ExponentSteps; ++e)
+		{
+			const float exponent = maxExponent * e / (ExponentSteps - 1);
+
+			for (int b{}; b <= BaseSteps; ++b)
+			{
+				m_Values[e * (BaseSteps + 1) + b] = powf(float(b) / BaseSteps, exponent);
+			}
+		}
+	}
+
+	__m256 PowTable::Sample(__m256 base, __m256 exponent) const
+	{
+		// max before min so NaN lanes land on 0 and never index out of the table
+		const __m256 zero = _mm256_setzero_ps();
+		base = _mm256_min_ps(_mm256_max_ps(base, zero), _mm256_set1_ps(1.f));
+		exponent = _mm256_min_ps(_mm256_max_ps(exponent, zero), _mm256_set1_ps(m_MaxExponent));
+
+		const __m256 scaledBase = _mm256_mul_ps(base, _mm256_set1_ps(float(BaseSteps)));
+		const __m256i baseIndex = _mm256_min_epi32(_mm256_cvttps_epi32(scaledBase), _mm256_set1_epi32(BaseSteps - 1));
+		const __m256 t = _mm256_sub_ps(scaledBase, _mm256_cvtepi32_ps(baseIndex));
+
+		const __m256i exponentIndex = _mm256_cvtps_epi32(_mm256_mul_ps(exponent, _mm256_set1_ps((ExponentSteps - 1) / m_MaxExponent)));
+		const __m256i index = _mm256_add_epi32(_mm256_mullo_epi32(exponentIndex, _mm256_set1_epi32(BaseSteps + 1)), baseIndex);
+
+		const __m256 v0 = _mm256_i32gather_ps(m_Values.data(), index, sizeof(float));
+		const __m256 v1 = _mm256_i32gather_ps(m_Values.data() + 1, index, sizeof(float));
+
+		const __m256 result = _mm256_add_ps(v0, _mm256_mul_ps(_mm256_sub_ps(v1, v0), t));
+
+		// Rows below exponent 1 rise too steeply out of base 0 to interpolate, those lanes take the polynomial
+		const __m256 steep = _mm256_cmp_ps(exponent, _mm256_set1_ps(1.f), _CMP_LT_OQ);
+		if (_mm256_movemask_ps(steep) == 0)
+		{
+			return result;
+		}
+
+		return _mm256_blendv_ps(result, FastPow::Polynomial(base, exponent), steep);
+	}
+
+	namespace FastPow
+	{
+		__m256 Exact(__m256 base, __m256 exponent, __m256 mask)
+		{
+			const int lanes = _mm256_movemask_ps(mask);
+
+			alignas(32) float b[8], e[8], result[8]{};
+			_mm256_store_ps(b, base);
+			_mm256_store_ps(e, exponent);
+
+			for (int lane{}; lane < 8; ++lane)
+			{
+				if (lanes & (1 << lane))
+				{
+					result[lane] = powf(b[lane], e[lane]);
+				}
+			}
+
+			return _mm256_load_ps(result);
+		}
+
+		__m256 Polynomial(__m256 base, __m256 exponent)
+		{
+			// Zero and NaN bases clamp to the smallest normal, 2^(-126 * exponent) underflows to ~0 like powf
+			base = _mm256_max_ps(base, _mm256_set1_ps(FLT_MIN));
+
+			// log2(base) = e + log2(m), m in [1, 2)
+			const __m256i bits = _mm256_castps_si256(base);
+			const __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+			const __m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)), _mm256_set1_epi32(0x3F800000)));
+			const __m256 t = _mm256_sub_ps(m, _mm256_set1_ps(1.f));
+
+			// log2(1 + t) / t, Chebyshev fit on [0, 1]
+			__m256 p = _mm256_set1_ps(-0.033822046f);
+			p = _mm256_fmadd_ps(p, t, _mm256_set1_ps(0.144471096f));
+			p = _mm256_fmadd_ps(p, t, _mm256_set1_ps(-0.30163801f));
+			p = _mm256_fmadd_ps(p, t, _mm256_set1_ps(0.468658879f));
+			p = _mm256_fmadd_ps(p, t, _mm256_set1_ps(-0.720358773f));
+			p = _mm256_fmadd_ps(p, t, _mm256_set1_ps(1.44268147f));
+			const __m256 log2Base = _mm256_fmadd_ps(p, t, e);
+
+			// exp2(y) = 2^i * exp2(f), f in [0, 1)
+			const __m256 y = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(exponent, log2Base), _mm256_set1_ps(-126.f)), _mm256_set1_ps(126.f));
+			const __m256 i = _mm256_floor_ps(y);
+			const __m256 f = _mm256_sub_ps(y, i);
+
+			__m256 q = _mm256_set1_ps(0.0136703095f);
+			q = _mm256_fmadd_ps(q, f, _mm256_set1_ps(0.0517449978f));
+			q = _mm256_fmadd_ps(q, f, _mm256_set1_ps(0.241604357f));
+			q = _mm256_fmadd_ps(q, f, _mm256_set1_ps(0.692972922f));
+			q = _mm256_fmadd_ps(q, f, _mm256_set1_ps(1.00000349f));
+
+			const __m256i scale = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(i), _mm256_set1_epi32(127)), 23);
+			return _mm256_mul_ps(q, _mm256_castsi256_ps(scale));
+		}
+
+		__m256 Evaluate(PowMode mode, const PowTable& table, __m256 base, __m256 exponent, __m256 mask)
+		{
+			switch (mode)
+			{
+			case PowMode::Polynomial:
+				return Polynomial(base, exponent);
+			case PowMode::LookupTable:
+				return table.Sample(base, exponent);
+			default:
+				return Exact(base, exponent, mask);
+			}
+		}
+
+		void PrintErrorReport(PowMode mode, const PowTable& table)
+		{
+			constexpr int baseSamples{ 4096 };
+			constexpr int exponentSamples{ 256 };
+
+			const __m256 laneOffsets = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+			const __m256 allLanes = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+			double maxAbsoluteError{};
+			double maxRelativeError{};
+			double totalAbsoluteError{};
+			int sampleCount{};
+
+			for (int e{}; e < exponentSamples; ++e)
+			{
+				const float exponent = table.GetMaxExponent() * e / (exponentSamples - 1);
+
+				for (int b{}; b <= baseSamples; b += 8)
+				{
+					const __m256 base = _mm256_min_ps(_mm256_div_ps(_mm256_add_ps(_mm256_set1_ps(float(b)), laneOffsets), _mm256_set1_ps(float(baseSamples))), _mm256_set1_ps(1.f));
+
+					alignas(32) float bases[8], results[8];
+					_mm256_store_ps(bases, base);
+					_mm256_store_ps(results, Evaluate(mode, table, base, _mm256_set1_ps(exponent), allLanes));
+
+					for (int lane{}; lane < 8; ++lane)
+					{
+						const double exact = std::pow(double(bases[lane]), double(exponent));
+						const double error = std::abs(results[lane] - exact);
+
+						maxAbsoluteError = std::max(maxAbsoluteError, error);
+						totalAbsoluteError += error;
+						++sampleCount;
+						// Relative error only where the result can still show up in an 8 bit channel
+						if (exact > 1.0 / 255.0)
+						{
+							maxRelativeError = std::max(maxRelativeError, error / exact);
+						}
+					}
+				}
+			}
+
+			std::cout << "  max absolute error: " << maxAbsoluteError << " (" << maxAbsoluteError * 255.0 << " of an 8 bit step)\n";
+			std::cout << "  mean absolute error: " << totalAbsoluteError / sampleCount << "\n";
+			std::cout << "  max relative error above 1/255: " << maxRelativeError << "\n";
+		}
+
+		const char* GetName(PowMode mode)
+		{
+			switch (mode)
+			{
+			case PowMode::Polynomial:
+				return "Polynomial";
+			case PowMode::LookupTable:
+				return "Lookup Table";
+			default:
+				return "Exact";
+			}
+		}
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <immintrin.h>
+#include <vector>
+
+namespace dae
+{
+	// How the specular term raises N.R to the gloss exponent
+	enum class PowMode
+	{
+		Exact,
+		Polynomial,
+		LookupTable,
+		End
+	};
+
+	// Bases in [0, 1] and exponents in [0, maxExponent], linear between base samples.
+	// Exponents snap to 256 steps, which is exact for 8 bit gloss maps scaled by maxExponent.
+	// Exponents below 1 are steep near base 0 and use FastPow::Polynomial instead. On the exponent steps and up
+	// to an exponent of 25 the absolute error stays below 1.1e-3, the relative error below 4.5e-3 wherever the
+	// result is above 1/255
+	class PowTable final
+	{
+	public:
+		explicit PowTable(float maxExponent);
+
+		__m256 Sample(__m256 base, __m256 exponent) const;
+		float GetMaxExponent() const { return m_MaxExponent; }
+
+	private:
+		static constexpr int BaseSteps{ 256 };
+		static constexpr int ExponentSteps{ 256 };
+
+		float m_MaxExponent{};
+		// ExponentSteps rows of BaseSteps + 1 samples, the last one is base == 1
+		std::vector<float> m_Values{};
+	};
+
+	namespace FastPow
+	{
+		// powf per lane, lanes outside the mask return 0
+		__m256 Exact(__m256 base, __m256 exponent, __m256 mask);
+
+		// exp2(exponent * log2(base)) with a degree 5 log2 and degree 4 exp2 polynomial. For bases in [0, 1] and
+		// exponents up to 25 the absolute error stays below 2e-4, the relative error below 1.3e-4 wherever the
+		// result is above 1/255
+		__m256 Polynomial(__m256 base, __m256 exponent);
+
+		__m256 Evaluate(PowMode mode, const PowTable& table, __m256 base, __m256 exponent, __m256 mask);
+
+		// Compares a mode against pow over the table's whole domain and prints the largest errors, the relative
+		// one over results above 1/255 like the bound of Polynomial
+		void PrintErrorReport(PowMode mode, const PowTable& table);
+
+		const char* GetName(PowMode mode);
+	}
+}
@@ -0,0 +1,196 @@
+#include "FrameBuffer.h"
+#include <SDL_surface.h>
+#include <algorithm>
+
+namespace dae
+{
+	namespace
+	{
+		uint32_t ToSDLFormat(PixelFormat format)
+		{
+			switch (format)
+			{
+			case PixelFormat::ARGB8888:
+				return SDL_PIXELFORMAT_ARGB8888;
+			case PixelFormat::ABGR8888:
+				return SDL_PIXELFORMAT_ABGR8888;
+			case PixelFormat::BGRA8888:
+				return SDL_PIXELFORMAT_BGRA8888;
+			case PixelFormat::RGB565:
+				return SDL_PIXELFORMAT_RGB565;
+			default:
+				return SDL_PIXELFORMAT_RGB888;
+			}
+		}
+
+		constexpr int GetBytesPerPixel(PixelFormat format)
+		{
+			return format == PixelFormat::RGB565 ? 2 : 4;
+		}
+	}
+
+	FrameBuffer::FrameBuffer(int width, int height, PixelFormat format) :
+		m_Width{ width },
+		m_Height{ height },
+		m_Format{ format }
+	{
+		m_pSurface = SDL_CreateRGBSurfaceWithFormat(0, width, height, GetBytesPerPixel(format) * 8, ToSDLFormat(format));
+		m_pPixels = static_cast<uint8_t*>(m_pSurface->pixels);
+		m_Pitch = m_pSurface->pitch;
+
+		// Picked once here, the raster loop never looks at the format again
+		switch (format)
+		{
+		case PixelFormat::ARGB8888:
+			SelectFormat<PixelFormat::ARGB8888>();
+			break;
+		case PixelFormat::ABGR8888:
+			SelectFormat<PixelFormat::ABGR8888>();
+			break;
+		case PixelFormat::BGRA8888:
+			SelectFormat<PixelFormat::BGRA8888>();
+			break;
+		case PixelFormat::RGB565:
+			SelectFormat<PixelFormat::RGB565>();
+			break;
+		default:
+			SelectFormat<PixelFormat::XRGB8888>();
+			break;
+		}
+	}
+
+	FrameBuffer::~FrameBuffer()
+	{
+		if (m_pSurface)
+		{
+			SDL_FreeSurface(m_pSurface);
+			m_pSurface = nullptr;
+		}
+	}
+
+	PixelFormat FrameBuffer::FromSDLFormat(uint32_t sdlFormat)
+	{
+		switch (sdlFormat)
+		{
+		case SDL_PIXELFORMAT_ARGB8888:
+			return PixelFormat::ARGB8888;
+		case SDL_PIXELFORMAT_ABGR8888:
+			return PixelFormat::ABGR8888;
+		case SDL_PIXELFORMAT_BGRA8888:
+			return PixelFormat::BGRA8888;
+		case SDL_PIXELFORMAT_RGB565:
+			return PixelFormat::RGB565;
+		default:
+			return PixelFormat::XRGB8888;
+		}
+	}
+
+	void FrameBuffer::Clear(const ColorRGB& color)
+	{
+		const uint32_t pixel = uint32_t(_mm256_cvtsi256_si32(m_pPack(Quantize(ColorRGBPacket::Broadcast(color)))));
+
+		for (int y{}; y < m_Height; ++y)
+		{
+			uint8_t* pRow = m_pPixels + y * m_Pitch;
+
+			if (m_Format == PixelFormat::RGB565)
+			{
+				std::fill_n(reinterpret_cast<uint16_t*>(pRow), m_Width, uint16_t(pixel));
+			}
+			else
+			{
+				std::fill_n(reinterpret_cast<uint32_t*>(pRow), m_Width, pixel);
+			}
+		}
+	}
+
+	template<PixelFormat Format>
+	void FrameBuffer::SelectFormat()
+	{
+		m_pPack = &FrameBuffer::Pack<Format>;
+		m_pWriteBytes = &FrameBuffer::WriteBytesAs<Format>;
+	}
+
+	BytePacket FrameBuffer::Quantize(const ColorRGBPacket& color)
+	{
+		ColorRGBPacket clamped{ color };
+		clamped.MaxToOne();
+
+		// Truncating like a cast to uint8_t, max first so negative and NaN lanes land on 0
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 scale = _mm256_set1_ps(255.f);
+		return {
+			_mm256_cvttps_epi32(_mm256_max_ps(_mm256_mul_ps(clamped.r, scale), zero)),
+			_mm256_cvttps_epi32(_mm256_max_ps(_mm256_mul_ps(clamped.g, scale), zero)),
+			_mm256_cvttps_epi32(_mm256_max_ps(_mm256_mul_ps(clamped.b, scale), zero))
+		};
+	}
+
+	template<PixelFormat Format>
+	__m256i FrameBuffer::Pack(const BytePacket& rgb)
+	{
+		const auto& [r, g, b] = rgb;
+
+		if constexpr (Format == PixelFormat::RGB565)
+		{
+			return _mm256_or_si256(_mm256_or_si256(
+				_mm256_slli_epi32(_mm256_srli_epi32(r, 3), 11),
+				_mm256_slli_epi32(_mm256_srli_epi32(g, 2), 5)),
+				_mm256_srli_epi32(b, 3));
+		}
+		else
+		{
+			constexpr int redShift{ Format == PixelFormat::ABGR8888 ? 0 : Format == PixelFormat::BGRA8888 ? 8 : 16 };
+			constexpr int blueShift{ Format == PixelFormat::ABGR8888 ? 16 : Format == PixelFormat::BGRA8888 ? 24 : 0 };
+			constexpr int greenShift{ Format == PixelFormat::BGRA8888 ? 16 : 8 };
+			constexpr uint32_t alpha{ Format == PixelFormat::XRGB8888 ? 0u : Format == PixelFormat::BGRA8888 ? 0xFFu : 0xFF000000u };
+
+			return _mm256_or_si256(_mm256_or_si256(
+				_mm256_slli_epi32(r, redShift),
+				_mm256_slli_epi32(g, greenShift)),
+				_mm256_or_si256(_mm256_slli_epi32(b, blueShift), _mm256_set1_epi32(int(alpha))));
+		}
+	}
+
+	template<PixelFormat Format>
+	void FrameBuffer::WriteBytesAs(int x, int y, const BytePacket& rgb, __m256 mask)
+	{
+		const __m256i pixels = Pack<Format>(rgb);
+		uint8_t* pRow = m_pPixels + y * m_Pitch;
+
+		if constexpr (GetBytesPerPixel(Format) == 4)
+		{
+			_mm256_maskstore_epi32(reinterpret_cast<int*>(pRow) + x, _mm256_castps_si256(mask), pixels);
+		}
+		else
+		{
+			uint16_t* pPixels = reinterpret_cast<uint16_t*>(pRow) + x;
+
+			// Narrow both to 8 x 16 bits, packs works per 128 bit half so the halves get joined after
+			const __m128i packed = _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi32(pixels, pixels), 0b1000));
+			const __m256i wideMask = _mm256_castps_si256(mask);
+			const __m128i packedMask = _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packs_epi32(wideMask, wideMask), 0b1000));
+
+			if (x + 8 <= m_Width)
+			{
+				const __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pPixels));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(pPixels), _mm_blendv_epi8(current, packed, packedMask));
+			}
+			else
+			{
+				// The last packet of a row can reach past the end of the buffer
+				alignas(16) uint16_t values[8];
+				_mm_store_si128(reinterpret_cast<__m128i*>(values), packed);
+				const int lanes = _mm256_movemask_ps(mask);
+
+				for (int lane{}; lane < m_Width - x; ++lane)
+				{
+					if (lanes & (1 << lane))
+					{
+						pPixels[lane] = values[lane];
+					}
+				}
+			}
+		}
+	}
+}
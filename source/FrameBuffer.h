@@ -0,0 +1,83 @@
+#pragma once
+#include <cstdint>
+#include <immintrin.h>
+
+#include "ColorRGB.h"
+#include "Packet.h"
+
+struct SDL_Surface;
+
+namespace dae
+{
+	// Packed layouts the frame buffer can write, named from the most significant bit down
+	enum class PixelFormat
+	{
+		XRGB8888,
+		ARGB8888,
+		ABGR8888,
+		BGRA8888,
+		RGB565
+	};
+
+	// 8 bit channels of 8 pixels, one per 32 bit lane
+	struct BytePacket
+	{
+		__m256i r{};
+		__m256i g{};
+		__m256i b{};
+	};
+
+	// Color target with its pixel format fixed at construction, every write goes through
+	// the packer compiled for that format
+	class FrameBuffer final
+	{
+	public:
+		FrameBuffer(int width, int height, PixelFormat format);
+		~FrameBuffer();
+
+		FrameBuffer(const FrameBuffer&) = delete;
+		FrameBuffer(FrameBuffer&&) noexcept = delete;
+		FrameBuffer& operator=(const FrameBuffer&) = delete;
+		FrameBuffer& operator=(FrameBuffer&&) noexcept = delete;
+
+		// Formats without a packer fall back to XRGB8888, SDL converts when blitting
+		static PixelFormat FromSDLFormat(uint32_t sdlFormat);
+
+		void Clear(const ColorRGB& color);
+		// Writes the lanes in the mask to 8 pixels starting at (x, y). Colors brighter than 1 are
+		// scaled back by their largest channel, like ColorRGB::MaxToOne, before converting to bytes
+		void WritePacket(int x, int y, const ColorRGBPacket& color, __m256 mask)
+		{
+			WriteBytes(x, y, Quantize(color), mask);
+		}
+		// Same as WritePacket for channels that are already 8 bit
+		void WriteBytes(int x, int y, const BytePacket& rgb, __m256 mask)
+		{
+			(this->*m_pWriteBytes)(x, y, rgb, mask);
+		}
+
+		SDL_Surface* GetSurface() const { return m_pSurface; }
+		PixelFormat GetFormat() const { return m_Format; }
+
+	private:
+		using PackFunction = __m256i(*)(const BytePacket&);
+		using WriteFunction = void (FrameBuffer::*)(int, int, const BytePacket&, __m256);
+
+		static BytePacket Quantize(const ColorRGBPacket& color);
+		template<PixelFormat Format>
+		static __m256i Pack(const BytePacket& rgb);
+		template<PixelFormat Format>
+		void SelectFormat();
+		template<PixelFormat Format>
+		void WriteBytesAs(int x, int y, const BytePacket& rgb, __m256 mask);
+
+		SDL_Surface* m_pSurface{ nullptr };
+		uint8_t* m_pPixels{ nullptr };
+		int m_Width{};
+		int m_Height{};
+		int m_Pitch{};
+		PixelFormat m_Format{};
+		PackFunction m_pPack{ nullptr };
+		WriteFunction m_pWriteBytes{ nullptr };
+	};
+}
@@ -0,0 +1,147 @@
+#include "HdrBuffer.h"
+#include "FrameBuffer.h"
+#include <cfloat>
+#include <cmath>
+
+namespace dae
+{
+	HdrBuffer::HdrBuffer(int width, int height, HdrPrecision precision) :
+		m_Width{ width },
+		m_Height{ height },
+		m_Stride{ (width + 7) & ~7 },
+		m_Precision{ precision },
+		m_EncodeTable(EncodeSteps + 1)
+	{
+		for (int c{}; c < 3; ++c)
+		{
+			if (precision == HdrPrecision::Half)
+			{
+				m_HalfPlanes[c].resize(m_Stride * height);
+			}
+			else
+			{
+				m_FloatPlanes[c].resize(m_Stride * height);
+			}
+		}
+
+		for (int i{}; i <= EncodeSteps; ++i)
+		{
+			const float linear = float(i) / EncodeSteps;
+			const float encoded = linear <= 0.0031308f ? linear * 12.92f : 1.055f * powf(linear, 1.f / 2.4f) - 0.055f;
+			m_EncodeTable[i] = int(encoded * 255.f + 0.5f);
+		}
+	}
+
+	void HdrBuffer::WritePacket(int x, int y, const ColorRGBPacket& color, __m256 mask)
+	{
+		const int index = y * m_Stride + x;
+		const __m256 channels[3]{ color.r, color.g, color.b };
+
+		if (m_Precision == HdrPrecision::Half)
+		{
+			// 8 x 16 bit lanes of the mask to blend with what is already there
+			const __m256i wideMask = _mm256_castps_si256(mask);
+			const __m128i halfMask = _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packs_epi32(wideMask, wideMask), 0b1000));
+			const __m256 halfMax = _mm256_set1_ps(HalfMax);
+
+			for (int c{}; c < 3; ++c)
+			{
+				__m128i* pPixels = reinterpret_cast<__m128i*>(&m_HalfPlanes[c][index]);
+				const __m128i halves = _mm256_cvtps_ph(_mm256_min_ps(channels[c], halfMax), _MM_FROUND_TO_NEAREST_INT);
+				_mm_storeu_si128(pPixels, _mm_blendv_epi8(_mm_loadu_si128(pPixels), halves, halfMask));
+			}
+		}
+		else
+		{
+			for (int c{}; c < 3; ++c)
+			{
+				_mm256_maskstore_ps(&m_FloatPlanes[c][index], _mm256_castps_si256(mask), channels[c]);
+			}
+		}
+	}
+
+	ColorRGBPacket HdrBuffer::ReadPacket(int x, int y) const
+	{
+		const int index = y * m_Stride + x;
+
+		if (m_Precision == HdrPrecision::Half)
+		{
+			const auto load = [this, index](int c) { return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&m_HalfPlanes[c][index]))); };
+			return { load(0), load(1), load(2) };
+		}
+
+		return { _mm256_loadu_ps(&m_FloatPlanes[0][index]), _mm256_loadu_ps(&m_FloatPlanes[1][index]), _mm256_loadu_ps(&m_FloatPlanes[2][index]) };
+	}
+
+	void HdrBuffer::Resolve(FrameBuffer& target, const float* pDepth, float exposure, ToneMapper toneMapper) const
+	{
+		if (toneMapper == ToneMapper::ACES)
+		{
+			ResolveWith<ToneMapper::ACES>(target, pDepth, exposure);
+		}
+		else
+		{
+			ResolveWith<ToneMapper::Reinhard>(target, pDepth, exposure);
+		}
+	}
+
+	const char* HdrBuffer::GetName(ToneMapper toneMapper)
+	{
+		return toneMapper == ToneMapper::ACES ? "ACES" : "Reinhard";
+	}
+
+	template<ToneMapper Mapper>
+	void HdrBuffer::ResolveWith(FrameBuffer& target, const float* pDepth, float exposure) const
+	{
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 one = _mm256_set1_ps(1.f);
+		const __m256 exposureScale = _mm256_set1_ps(exposure);
+		const __m256 encodeScale = _mm256_set1_ps(float(EncodeSteps));
+		const __m256 maxColor = _mm256_set1_ps(HalfMax);
+		const __m256i maxIndex = _mm256_set1_epi32(EncodeSteps);
+		const __m256 farDepth = _mm256_set1_ps(FLT_MAX);
+		const __m256i laneIndices = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+		const auto toneMap = [&](__m256 c)
+		{
+			// Bounded before the curves so infinities can't turn into NaN, NaN itself drops to zero in the max
+			c = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(c, exposureScale), zero), maxColor);
+
+			if constexpr (Mapper == ToneMapper::ACES)
+			{
+				// Narkowicz's fit of the ACES filmic curve
+				const __m256 numerator = _mm256_mul_ps(c, _mm256_fmadd_ps(c, _mm256_set1_ps(2.51f), _mm256_set1_ps(0.03f)));
+				const __m256 denominator = _mm256_fmadd_ps(c, _mm256_fmadd_ps(c, _mm256_set1_ps(2.43f), _mm256_set1_ps(0.59f)), _mm256_set1_ps(0.14f));
+				c = Saturate(_mm256_div_ps(numerator, denominator));
+			}
+			else
+			{
+				c = _mm256_div_ps(c, _mm256_add_ps(one, c));
+			}
+
+			const __m256i index = _mm256_min_epi32(_mm256_max_epi32(_mm256_cvtps_epi32(_mm256_mul_ps(c, encodeScale)), _mm256_setzero_si256()), maxIndex);
+			return _mm256_i32gather_epi32(m_EncodeTable.data(), index, sizeof(int));
+		};
+
+		for (int y{}; y < m_Height; ++y)
+		{
+			const float* pDepthRow = pDepth + y * m_Width;
+
+			for (int x{}; x < m_Width; x += 8)
+			{
+				// The depth buffer rows aren't padded, keep the last packet of a row inside it
+				const __m256i inRow = _mm256_cmpgt_epi32(_mm256_set1_epi32(m_Width - x), laneIndices);
+				const __m256 depth = _mm256_maskload_ps(pDepthRow + x, inRow);
+				const __m256 covered = _mm256_and_ps(_mm256_castsi256_ps(inRow), _mm256_cmp_ps(depth, farDepth, _CMP_LT_OQ));
+
+				if (_mm256_movemask_ps(covered) == 0)
+				{
+					continue;
+				}
+
+				const ColorRGBPacket color = ReadPacket(x, y);
+				target.WriteBytes(x, y, { toneMap(color.r), toneMap(color.g), toneMap(color.b) }, covered);
+			}
+		}
+	}
+}
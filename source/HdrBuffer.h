@@ -0,0 +1,60 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <immintrin.h>
+#include <vector>
+
+#include "Packet.h"
+
+namespace dae
+{
+	class FrameBuffer;
+
+	enum class HdrPrecision
+	{
+		Float,
+		Half
+	};
+
+	enum class ToneMapper
+	{
+		Reinhard,
+		ACES,
+		End
+	};
+
+	// Linear color target that shading accumulates into without clipping. One plane per channel,
+	// rows padded to a multiple of 8 so every packet load and store stays inside its row
+	class HdrBuffer final
+	{
+	public:
+		HdrBuffer(int width, int height, HdrPrecision precision);
+
+		void WritePacket(int x, int y, const ColorRGBPacket& color, __m256 mask);
+		ColorRGBPacket ReadPacket(int x, int y) const;
+
+		// Exposure, tonemap and sRGB encode into the back buffer in one pass. Only pixels with a depth
+		// in front of the far clear get written, the rest keep the back buffer's clear color
+		void Resolve(FrameBuffer& target, const float* pDepth, float exposure, ToneMapper toneMapper) const;
+
+		static const char* GetName(ToneMapper toneMapper);
+
+	private:
+		// Linear [0, 1] to 8 bit sRGB, fine enough that neighbouring entries never skip a byte value
+		static constexpr int EncodeSteps{ 4096 };
+		// Largest finite half, anything above it would be stored as infinity
+		static constexpr float HalfMax{ 65504.f };
+
+		int m_Width{};
+		int m_Height{};
+		int m_Stride{};
+		HdrPrecision m_Precision{};
+
+		std::array<std::vector<float>, 3> m_FloatPlanes{};
+		std::array<std::vector<uint16_t>, 3> m_HalfPlanes{};
+		std::vector<int> m_EncodeTable{};
+
+		template<ToneMapper Mapper>
+		void ResolveWith(FrameBuffer& target, const float* pDepth, float exposure) const;
+	};
+}
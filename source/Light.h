@@ -0,0 +1,34 @@
+#pragma once
+#include "Math.h"
+
+namespace dae
+{
+	enum class LightType
+	{
+		Directional,
+		Point,
+		Spot
+	};
+
+	struct Light
+	{
+		LightType type{ LightType::Directional };
+		Vector3 position{};
+		// Direction the light travels in, unused by point lights
+		Vector3 direction{ Vector3::UnitZ };
+		ColorRGB color{ colors::White };
+		float intensity{ 1.f };
+		// Scales the highlights, which intensity leaves alone so the default light keeps its look
+		float specularIntensity{ 1.f };
+
+		// Point and spot lights fade out to nothing at this distance
+		float range{ 10.f };
+
+		// Cosines of the spot cone half angles, full intensity inside the inner one
+		float innerConeCos{ 0.95f };
+		float outerConeCos{ 0.85f };
+
+		// Only the first shadow casting directional light gets a shadow map
+		bool castsShadows{ false };
+	};
+}
@@ -0,0 +1,110 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace dae
+{
+#ifdef _WIN32
+	MappedFile::MappedFile(const std::string& path)
+	{
+		m_File = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (m_File == INVALID_HANDLE_VALUE)
+		{
+			m_File = nullptr;
+			return;
+		}
+
+		LARGE_INTEGER size{};
+		if (!GetFileSizeEx(m_File, &size))
+		{
+			return;
+		}
+
+		// Empty files can't be mapped
+		m_IsOpen = size.QuadPart == 0;
+		if (m_IsOpen)
+		{
+			return;
+		}
+
+		m_Mapping = CreateFileMappingA(m_File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!m_Mapping)
+		{
+			return;
+		}
+
+		m_pData = static_cast<const uint8_t*>(MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0));
+		m_Size = m_pData ? size_t(size.QuadPart) : 0;
+		m_IsOpen = m_pData != nullptr;
+	}
+
+	MappedFile::~MappedFile()
+	{
+		if (m_pData)
+		{
+			UnmapViewOfFile(m_pData);
+		}
+		if (m_Mapping)
+		{
+			CloseHandle(m_Mapping);
+		}
+		if (m_File)
+		{
+			CloseHandle(m_File);
+		}
+	}
+#else
+	MappedFile::MappedFile(const std::string& path)
+	{
+		m_File = open(path.c_str(), O_RDONLY);
+		if (m_File < 0)
+		{
+			return;
+		}
+
+		struct stat status{};
+		if (fstat(m_File, &status) != 0)
+		{
+			return;
+		}
+
+		// Empty files can't be mapped
+		m_IsOpen = status.st_size == 0;
+		if (m_IsOpen)
+		{
+			return;
+		}
+
+		void* pData = mmap(nullptr, size_t(status.st_size), PROT_READ, MAP_PRIVATE, m_File, 0);
+		if (pData == MAP_FAILED)
+		{
+			return;
+		}
+
+		m_pData = static_cast<const uint8_t*>(pData);
+		m_Size = size_t(status.st_size);
+		m_IsOpen = true;
+	}
+
+	MappedFile::~MappedFile()
+	{
+		if (m_pData)
+		{
+			munmap(const_cast<uint8_t*>(m_pData), m_Size);
+		}
+		if (m_File >= 0)
+		{
+			close(m_File);
+		}
+	}
+#endif
+}
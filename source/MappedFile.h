@@ -0,0 +1,34 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace dae
+{
+	// Read only view of a whole file through the OS page cache, nothing is read until it is touched.
+	// Empty when the file can't be opened or has no bytes, only the first isn't open
+	class MappedFile final
+	{
+	public:
+		explicit MappedFile(const std::string& path);
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		bool IsOpen() const { return m_IsOpen; }
+		const uint8_t* GetData() const { return m_pData; }
+		size_t GetSize() const { return m_Size; }
+
+	private:
+		const uint8_t* m_pData{};
+		size_t m_Size{};
+		bool m_IsOpen{};
+#ifdef _WIN32
+		void* m_File{};
+		void* m_Mapping{};
+#else
+		int m_File{ -1 };
+#endif
+	};
+}
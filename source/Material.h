@@ -0,0 +1,28 @@
+#pragma once
+#include "Texture.h"
+
+namespace dae
+{
+	// Surface description shared by every mesh that references it. The textures are owned
+	// by the renderer so several materials can reuse the same image
+	struct Material
+	{
+		const Texture* pDiffuse{ nullptr };
+		const Texture* pNormal{ nullptr };
+		const Texture* pGloss{ nullptr };
+		const Texture* pSpecular{ nullptr };
+		// The four maps above interleaved into one texture, see Texture::PackMaterial
+		const Texture* pPacked{ nullptr };
+		// OBJ UVs run past [0, 1) and expect the image to tile
+		TextureAddress address{ TextureAddress::Wrap };
+
+		// Phong exponent at a gloss map value of 1
+		float shine{ 25.f };
+		// Scales the diffuse irradiance on top of each light's own intensity
+		float lightIntensity{ 1.f };
+
+		// Pipeline flags, the normal map is only used when the global toggle is on as well
+		bool useNormalMap{ true };
+		bool castsShadows{ true };
+	};
+}
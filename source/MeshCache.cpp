@@ -0,0 +1,283 @@
+#include "MeshCache.h"
+#include "MappedFile.h"
+#include "VertexPacking.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <type_traits>
+
+namespace dae
+{
+	namespace MeshCache
+	{
+		namespace
+		{
+			static_assert(std::is_trivially_copyable_v<Vertex> && std::is_trivially_copyable_v<PackedVertex>, "The streams are written and mapped as raw bytes");
+
+			// Precedes the level table and the streams
+			struct Header
+			{
+				uint32_t magic;
+				uint32_t version;
+				uint64_t sourceSize;
+				int64_t sourceTime;
+				// A file from a build with other vertex layouts is stale as well
+				uint32_t vertexSize;
+				uint32_t packedVertexSize;
+				uint32_t levelCount;
+				int32_t primitiveTopology;
+				float minBounds[3];
+				float maxBounds[3];
+				// BuildSettings and the packing quantization
+				uint32_t flipAxisAndWinding;
+				uint32_t maxLODs;
+				float reductionPerLOD;
+				uint32_t minTriangleCount;
+				float positionSteps;
+				float snormSteps;
+				// Over the level table, the offsets in it are trusted once this matches
+				uint64_t tableChecksum;
+			};
+
+			// Byte offset from the start of the file and element count
+			struct Stream
+			{
+				uint64_t offset;
+				uint64_t count;
+			};
+
+			// One per level, the full mesh first
+			struct LevelEntry
+			{
+				Stream vertices;
+				Stream indices;
+				Stream packedVertices;
+				Stream colors;
+				float error;
+				uint32_t padding;
+			};
+
+			constexpr uint32_t Magic{ 0x43534D44 }; // "DMSC"
+			// Every stream starts at a cache line
+			constexpr size_t Alignment{ 64 };
+
+			size_t Align(size_t offset)
+			{
+				return (offset + Alignment - 1) / Alignment * Alignment;
+			}
+
+			// FNV-1a
+			uint64_t Checksum(const void* pData, size_t size)
+			{
+				uint64_t hash{ 14695981039346656037ull };
+				for (size_t i{}; i < size; ++i)
+				{
+					hash = (hash ^ static_cast<const uint8_t*>(pData)[i]) * 1099511628211ull;
+				}
+				return hash;
+			}
+
+			std::string GetCachePath(const std::string& sourcePath)
+			{
+				return sourcePath + ".meshcache";
+			}
+
+			bool GetSourceKey(const std::string& sourcePath, uint64_t& size, int64_t& time)
+			{
+				std::error_code error{};
+				size = std::filesystem::file_size(sourcePath, error);
+				if (error)
+				{
+					return false;
+				}
+
+				time = std::filesystem::last_write_time(sourcePath, error).time_since_epoch().count();
+				return !error;
+			}
+
+			// False when the stream doesn't lie inside the file at an aligned offset
+			template<typename Element>
+			bool GetStream(const MappedFile& file, const Stream& stream, std::span<const Element>& view)
+			{
+				// Checked apart so a corrupt count can't wrap the end around
+				if (stream.offset % Alignment != 0 || stream.offset > file.GetSize() || stream.count > (file.GetSize() - stream.offset) / sizeof(Element))
+				{
+					return false;
+				}
+
+				view = { reinterpret_cast<const Element*>(file.GetData() + stream.offset), size_t(stream.count) };
+				return true;
+			}
+		}
+
+		bool Load(const std::string& sourcePath, const BuildSettings& settings, Mesh& mesh)
+		{
+			uint64_t sourceSize{};
+			int64_t sourceTime{};
+			if (!GetSourceKey(sourcePath, sourceSize, sourceTime))
+			{
+				return false;
+			}
+
+			auto pFile = std::make_shared<const MappedFile>(GetCachePath(sourcePath));
+			if (pFile->GetSize() < sizeof(Header))
+			{
+				return false;
+			}
+
+			Header header{};
+			memcpy(&header, pFile->GetData(), sizeof(header));
+
+			// A stale or foreign file is just rebuilt and overwritten
+			if (header.magic != Magic || header.version != Version || header.sourceSize != sourceSize || header.sourceTime != sourceTime ||
+				header.vertexSize != sizeof(Vertex) || header.packedVertexSize != sizeof(PackedVertex) ||
+				header.flipAxisAndWinding != uint32_t(settings.flipAxisAndWinding) || header.maxLODs != settings.maxLODs || header.reductionPerLOD != settings.reductionPerLOD ||
+				header.minTriangleCount != settings.minTriangleCount || header.positionSteps != VertexPacking::PositionSteps || header.snormSteps != VertexPacking::SnormSteps ||
+				header.primitiveTopology < 0 || header.primitiveTopology > int32_t(PrimitiveTopology::TriangleStrip) || header.levelCount == 0 ||
+				header.levelCount > (pFile->GetSize() - sizeof(Header)) / sizeof(LevelEntry))
+			{
+				return false;
+			}
+
+			std::vector<LevelEntry> levels(header.levelCount);
+			memcpy(levels.data(), pFile->GetData() + sizeof(Header), levels.size() * sizeof(LevelEntry));
+			if (Checksum(levels.data(), levels.size() * sizeof(LevelEntry)) != header.tableChecksum)
+			{
+				return false;
+			}
+
+			std::vector<MappedMeshLevel> mappedLevels(header.levelCount);
+			std::vector<MeshLOD> lods(header.levelCount - 1);
+			for (size_t i{}; i < levels.size(); ++i)
+			{
+				MappedMeshLevel& level = mappedLevels[i];
+				if (!GetStream(*pFile, levels[i].vertices, level.vertices) || !GetStream(*pFile, levels[i].indices, level.indices) ||
+					!GetStream(*pFile, levels[i].packedVertices, level.packedVertices.vertices) || !GetStream(*pFile, levels[i].colors, level.packedVertices.colors))
+				{
+					return false;
+				}
+
+				// Packed meshes store no float vertices, a level with both streams has the same vertices in each
+				const size_t floatCount = level.vertices.size();
+				const size_t packedCount = level.packedVertices.vertices.size();
+				const size_t vertexCount = std::max(floatCount, packedCount);
+				if ((floatCount != 0 && packedCount != 0 && floatCount != packedCount) ||
+					(!level.packedVertices.colors.empty() && level.packedVertices.colors.size() != packedCount) ||
+					(PrimitiveTopology(header.primitiveTopology) == PrimitiveTopology::TriangleList && level.indices.size() % 3 != 0))
+				{
+					return false;
+				}
+
+				// The renderer indexes its transformed vertices with these unchecked
+				if (std::any_of(level.indices.begin(), level.indices.end(), [vertexCount](uint32_t index) { return index >= vertexCount; }))
+				{
+					return false;
+				}
+
+				if (i > 0)
+				{
+					lods[i - 1].error = levels[i].error;
+				}
+			}
+
+			mesh.vertices = {};
+			mesh.indices = {};
+			mesh.packedVertices = {};
+			mesh.lods = std::move(lods);
+			mesh.primitiveTopology = PrimitiveTopology(header.primitiveTopology);
+			mesh.minBounds = { header.minBounds[0], header.minBounds[1], header.minBounds[2] };
+			mesh.maxBounds = { header.maxBounds[0], header.maxBounds[1], header.maxBounds[2] };
+			mesh.mappedLevels = std::move(mappedLevels);
+			mesh.pMapping = std::move(pFile);
+			return true;
+		}
+
+		void Write(const std::string& sourcePath, const BuildSettings& settings, const Mesh& mesh)
+		{
+			Header header{ Magic, Version, 0, 0, sizeof(Vertex), sizeof(PackedVertex), uint32_t(mesh.lods.size() + 1), int32_t(mesh.primitiveTopology),
+				{ mesh.minBounds.x, mesh.minBounds.y, mesh.minBounds.z }, { mesh.maxBounds.x, mesh.maxBounds.y, mesh.maxBounds.z },
+				settings.flipAxisAndWinding, settings.maxLODs, settings.reductionPerLOD, settings.minTriangleCount, VertexPacking::PositionSteps, VertexPacking::SnormSteps, 0 };
+			if (!GetSourceKey(sourcePath, header.sourceSize, header.sourceTime))
+			{
+				return;
+			}
+
+			// The streams are placed first so the table in front of them can point at them
+			std::vector<LevelEntry> levels(header.levelCount);
+			size_t offset = sizeof(Header) + levels.size() * sizeof(LevelEntry);
+			const auto place = [&offset](Stream& stream, size_t count, size_t elementSize)
+			{
+				offset = Align(offset);
+				stream = { offset, count };
+				offset += count * elementSize;
+			};
+
+			for (uint32_t i{}; i < header.levelCount; ++i)
+			{
+				LevelEntry& level = levels[i];
+				const PackedVertexView packed = mesh.GetPackedVertices(i);
+
+				place(level.vertices, mesh.GetVertices(i).size(), sizeof(Vertex));
+				place(level.indices, mesh.GetIndices(i).size(), sizeof(uint32_t));
+				place(level.packedVertices, packed.vertices.size(), sizeof(PackedVertex));
+				place(level.colors, packed.colors.size(), sizeof(uint32_t));
+				level.error = i == 0 ? 0.f : mesh.lods[i - 1].error;
+			}
+
+			header.tableChecksum = Checksum(levels.data(), levels.size() * sizeof(LevelEntry));
+
+			// Written aside and moved over the old file, so another process never maps a half written one
+			const std::string cachePath = GetCachePath(sourcePath);
+			const std::string tempPath = cachePath + ".tmp";
+			{
+				std::ofstream file{ tempPath, std::ios::binary | std::ios::trunc };
+				if (!file)
+				{
+					return;
+				}
+
+				size_t written{};
+				const auto write = [&file, &written](const void* pData, size_t size)
+				{
+					file.write(static_cast<const char*>(pData), std::streamsize(size));
+					written += size;
+				};
+				const auto writeStream = [&write, &written](const Stream& stream, const void* pData, size_t elementSize)
+				{
+					const char zeros[Alignment]{};
+					write(zeros, size_t(stream.offset) - written);
+					write(pData, size_t(stream.count) * elementSize);
+				};
+
+				write(&header, sizeof(header));
+				write(levels.data(), levels.size() * sizeof(LevelEntry));
+
+				for (uint32_t i{}; i < header.levelCount; ++i)
+				{
+					const PackedVertexView packed = mesh.GetPackedVertices(i);
+
+					writeStream(levels[i].vertices, mesh.GetVertices(i).data(), sizeof(Vertex));
+					writeStream(levels[i].indices, mesh.GetIndices(i).data(), sizeof(uint32_t));
+					writeStream(levels[i].packedVertices, packed.vertices.data(), sizeof(PackedVertex));
+					writeStream(levels[i].colors, packed.colors.data(), sizeof(uint32_t));
+				}
+
+				if (!file)
+				{
+					file.close();
+					std::error_code error{};
+					std::filesystem::remove(tempPath, error);
+					return;
+				}
+			}
+
+			std::error_code error{};
+			std::filesystem::rename(tempPath, cachePath, error);
+			if (error)
+			{
+				std::filesystem::remove(tempPath, error);
+			}
+		}
+	}
+}
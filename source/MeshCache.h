@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+#include "DataTypes.h"
+
+namespace dae
+{
+	// Finished meshes, LODs and packed streams included, stored next to their source as <source>.meshcache.
+	// Every stream starts at a cache line, so a loaded mesh points into the mapped file and nothing is copied.
+	// The file is keyed by the source's size and modification time, hashing a large source would cost about
+	// as much as the import it skips
+	namespace MeshCache
+	{
+		// Bump whenever the file layout or the code that produces the cached streams changes
+		constexpr uint32_t Version{ 3 };
+
+		// How the cached mesh was built from its source. Stored in the file, a cache built with other settings
+		// or vertex quantization is stale
+		struct BuildSettings
+		{
+			bool flipAxisAndWinding{ true };
+			uint32_t maxLODs{ 4 };
+			float reductionPerLOD{ 0.5f };
+			uint32_t minTriangleCount{ 256 };
+		};
+
+		// False when there is no cache for the source or it is stale or inconsistent, the mesh is left untouched
+		// then. Besides the header and level table only the indices are read, to bound them by the vertex count
+		bool Load(const std::string& sourcePath, const BuildSettings& settings, Mesh& mesh);
+		void Write(const std::string& sourcePath, const BuildSettings& settings, const Mesh& mesh);
+	}
+}
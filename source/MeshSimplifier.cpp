@@ -0,0 +1,414 @@
+#include "MeshSimplifier.h"
+
+#include <algorithm>
+#include <bit>
+#include <cfloat>
+#include <cstring>
+#include <unordered_map>
+
+namespace dae
+{
+	namespace
+	{
+		struct PositionHash
+		{
+			size_t operator()(const Vector3& p) const
+			{
+				const size_t x = std::bit_cast<uint32_t>(p.x);
+				const size_t y = std::bit_cast<uint32_t>(p.y);
+				const size_t z = std::bit_cast<uint32_t>(p.z);
+				return (x * 73856093) ^ (y * 19349663) ^ (z * 83492791);
+			}
+		};
+
+		struct PositionEqual
+		{
+			bool operator()(const Vector3& a, const Vector3& b) const
+			{
+				return a.x == b.x && a.y == b.y && a.z == b.z;
+			}
+		};
+
+		struct VertexHash
+		{
+			size_t operator()(const Vertex& v) const
+			{
+				const size_t uv = std::bit_cast<uint32_t>(v.uv.x) * 2654435761u + std::bit_cast<uint32_t>(v.uv.y);
+				return PositionHash{}(v.position) ^ (PositionHash{}(v.normal) << 1) ^ (uv << 2);
+			}
+		};
+
+		struct VertexEqual
+		{
+			bool operator()(const Vertex& a, const Vertex& b) const
+			{
+				return std::memcmp(&a, &b, sizeof(Vertex)) == 0;
+			}
+		};
+
+		uint64_t EdgeKey(uint32_t a, uint32_t b)
+		{
+			return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+		}
+
+		// Border edges get perpendicular planes so open silhouettes don't shrink
+		constexpr float BoundaryWeight = 10.f;
+		// Collapses rotating a surviving triangle further than ~75 degrees are rejected
+		constexpr float MinNormalCosine = 0.25f;
+	}
+
+	void MeshSimplifier::Quadric::AddPlane(const Vector3& normal, float distance, float weight)
+	{
+		const double a = normal.x, b = normal.y, c = normal.z, d = distance;
+
+		xx += weight * a * a; xy += weight * a * b; xz += weight * a * c; xw += weight * a * d;
+		yy += weight * b * b; yz += weight * b * c; yw += weight * b * d;
+		zz += weight * c * c; zw += weight * c * d;
+		ww += weight * d * d;
+	}
+
+	double MeshSimplifier::Quadric::Evaluate(const Vector3& p) const
+	{
+		const double x = p.x, y = p.y, z = p.z;
+
+		return xx * x * x + 2 * xy * x * y + 2 * xz * x * z + 2 * xw * x
+			+ yy * y * y + 2 * yz * y * z + 2 * yw * y
+			+ zz * z * z + 2 * zw * z
+			+ ww;
+	}
+
+	MeshSimplifier::Quadric& MeshSimplifier::Quadric::operator+=(const Quadric& q)
+	{
+		xx += q.xx; xy += q.xy; xz += q.xz; xw += q.xw;
+		yy += q.yy; yz += q.yz; yw += q.yw;
+		zz += q.zz; zw += q.zw;
+		ww += q.ww;
+
+		return *this;
+	}
+
+	MeshSimplifier::MeshSimplifier(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices) :
+		m_Vertices{ vertices }
+	{
+		// The OBJ parser emits three vertices per face, weld them back together
+		std::unordered_map<Vector3, uint32_t, PositionHash, PositionEqual> positionLookup{};
+		std::unordered_map<Vertex, uint32_t, VertexHash, VertexEqual> vertexLookup{};
+
+		m_VertexPositions.resize(vertices.size());
+		m_UniqueVertices.resize(vertices.size());
+
+		for (uint32_t i{}; i < vertices.size(); ++i)
+		{
+			const auto [positionIt, isNewPosition] = positionLookup.try_emplace(vertices[i].position, uint32_t(m_Positions.size()));
+			if (isNewPosition)
+			{
+				m_Positions.emplace_back(vertices[i].position);
+				m_PositionVertices.emplace_back();
+			}
+			m_VertexPositions[i] = positionIt->second;
+
+			const auto [vertexIt, isNewVertex] = vertexLookup.try_emplace(vertices[i], i);
+			m_UniqueVertices[i] = vertexIt->second;
+
+			if (isNewVertex)
+			{
+				m_PositionVertices[positionIt->second].push_back(i);
+			}
+		}
+
+		m_Quadrics.resize(m_Positions.size());
+		m_PositionTriangles.resize(m_Positions.size());
+		m_PositionVersions.resize(m_Positions.size());
+		m_PositionRemoved.resize(m_Positions.size());
+
+		const size_t triangleCount = indices.size() / 3;
+		m_Triangles.resize(triangleCount * 3);
+		m_Corners.assign(indices.begin(), indices.begin() + triangleCount * 3);
+		m_TriangleRemoved.resize(triangleCount);
+
+		std::unordered_map<uint64_t, uint32_t> edgeUsage{};
+
+		for (uint32_t t{}; t < triangleCount; ++t)
+		{
+			uint32_t* pTriangle = &m_Triangles[size_t(t) * 3];
+			for (int k{}; k < 3; ++k)
+			{
+				pTriangle[k] = m_VertexPositions[indices[size_t(t) * 3 + k]];
+			}
+
+			if (pTriangle[0] == pTriangle[1] || pTriangle[1] == pTriangle[2] || pTriangle[2] == pTriangle[0])
+			{
+				m_TriangleRemoved[t] = true;
+				continue;
+			}
+
+			++m_TriangleCount;
+
+			const Vector3& p0 = m_Positions[pTriangle[0]];
+			Vector3 normal = Vector3::Cross(m_Positions[pTriangle[1]] - p0, m_Positions[pTriangle[2]] - p0);
+			const float length = normal.Magnitude();
+
+			for (int k{}; k < 3; ++k)
+			{
+				m_PositionTriangles[pTriangle[k]].push_back(t);
+				++edgeUsage[EdgeKey(pTriangle[k], pTriangle[(k + 1) % 3])];
+
+				if (length > 0.f)
+				{
+					m_Quadrics[pTriangle[k]].AddPlane(normal / length, -Vector3::Dot(normal / length, p0), 1.f);
+				}
+			}
+		}
+
+		for (uint32_t t{}; t < triangleCount; ++t)
+		{
+			if (m_TriangleRemoved[t])
+			{
+				continue;
+			}
+
+			const uint32_t* pTriangle = &m_Triangles[size_t(t) * 3];
+			const Vector3& p0 = m_Positions[pTriangle[0]];
+			const Vector3 faceNormal = Vector3::Cross(m_Positions[pTriangle[1]] - p0, m_Positions[pTriangle[2]] - p0);
+
+			for (int k{}; k < 3; ++k)
+			{
+				const uint32_t a = pTriangle[k];
+				const uint32_t b = pTriangle[(k + 1) % 3];
+
+				if (edgeUsage[EdgeKey(a, b)] != 1)
+				{
+					continue;
+				}
+
+				Vector3 borderNormal = Vector3::Cross(m_Positions[b] - m_Positions[a], faceNormal);
+				if (borderNormal.SqrMagnitude() <= 0.f)
+				{
+					continue;
+				}
+
+				borderNormal.Normalize();
+				const float distance = -Vector3::Dot(borderNormal, m_Positions[a]);
+				m_Quadrics[a].AddPlane(borderNormal, distance, BoundaryWeight);
+				m_Quadrics[b].AddPlane(borderNormal, distance, BoundaryWeight);
+			}
+		}
+
+		for (const auto& [key, usage] : edgeUsage)
+		{
+			const uint32_t a = uint32_t(key >> 32);
+			const uint32_t b = uint32_t(key & 0xFFFFFFFF);
+
+			PushCollapse(a, b);
+			PushCollapse(b, a);
+		}
+	}
+
+	MeshLOD MeshSimplifier::Simplify(size_t targetTriangleCount)
+	{
+		while (m_TriangleCount > targetTriangleCount && !m_Collapses.empty())
+		{
+			const Collapse collapse = m_Collapses.top();
+			m_Collapses.pop();
+
+			if (m_PositionRemoved[collapse.from] || m_PositionRemoved[collapse.to] ||
+				m_PositionVersions[collapse.from] != collapse.fromVersion ||
+				m_PositionVersions[collapse.to] != collapse.toVersion)
+			{
+				continue;
+			}
+
+			if (TryCollapse(collapse))
+			{
+				m_Error = std::max(m_Error, sqrtf(static_cast<float>(std::max(collapse.cost, 0.0))));
+			}
+		}
+
+		MeshLOD lod{};
+		lod.error = m_Error;
+		lod.indices.reserve(m_TriangleCount * 3);
+
+		std::vector<uint32_t> remap(m_Vertices.size(), UINT32_MAX);
+
+		for (size_t t{}; t < m_TriangleRemoved.size(); ++t)
+		{
+			if (m_TriangleRemoved[t])
+			{
+				continue;
+			}
+
+			for (size_t k{}; k < 3; ++k)
+			{
+				const uint32_t position = m_Triangles[t * 3 + k];
+				const uint32_t corner = m_Corners[t * 3 + k];
+
+				// Corners that moved take the attributes of the closest vertex at their new position
+				const uint32_t source = m_VertexPositions[corner] == position ? m_UniqueVertices[corner] : FindClosestVertex(position, corner);
+
+				if (remap[source] == UINT32_MAX)
+				{
+					remap[source] = uint32_t(lod.vertices.size());
+					lod.vertices.emplace_back(m_Vertices[source]);
+				}
+
+				lod.indices.emplace_back(remap[source]);
+			}
+		}
+
+		return lod;
+	}
+
+	void MeshSimplifier::GenerateLODs(Mesh& mesh, uint32_t maxLODs, float reductionPerLOD, size_t minTriangleCount)
+	{
+		mesh.lods.clear();
+
+		if (mesh.primitiveTopology != PrimitiveTopology::TriangleList)
+		{
+			return;
+		}
+
+		MeshSimplifier simplifier{ mesh.vertices, mesh.indices };
+		size_t triangleCount = simplifier.GetTriangleCount();
+
+		for (uint32_t i{}; i < maxLODs; ++i)
+		{
+			const size_t targetTriangleCount = static_cast<size_t>(triangleCount * reductionPerLOD);
+			if (targetTriangleCount < minTriangleCount)
+			{
+				break;
+			}
+
+			MeshLOD lod = simplifier.Simplify(targetTriangleCount);
+
+			// Every remaining collapse would fold the surface over, no point in storing a copy
+			if (simplifier.GetTriangleCount() + simplifier.GetTriangleCount() / 10 >= triangleCount)
+			{
+				break;
+			}
+
+			triangleCount = simplifier.GetTriangleCount();
+			mesh.lods.emplace_back(std::move(lod));
+		}
+	}
+
+	void MeshSimplifier::PushCollapses(uint32_t position)
+	{
+		std::vector<uint32_t> neighbours{};
+
+		for (uint32_t t : m_PositionTriangles[position])
+		{
+			for (size_t k{}; k < 3; ++k)
+			{
+				const uint32_t other = m_Triangles[size_t(t) * 3 + k];
+				if (other != position && std::find(neighbours.begin(), neighbours.end(), other) == neighbours.end())
+				{
+					neighbours.emplace_back(other);
+				}
+			}
+		}
+
+		for (uint32_t neighbour : neighbours)
+		{
+			PushCollapse(position, neighbour);
+			PushCollapse(neighbour, position);
+		}
+	}
+
+	void MeshSimplifier::PushCollapse(uint32_t from, uint32_t to)
+	{
+		Quadric quadric{ m_Quadrics[from] };
+		quadric += m_Quadrics[to];
+
+		m_Collapses.push({ quadric.Evaluate(m_Positions[to]), from, to, m_PositionVersions[from], m_PositionVersions[to] });
+	}
+
+	bool MeshSimplifier::TryCollapse(const Collapse& collapse)
+	{
+		auto& fromTriangles = m_PositionTriangles[collapse.from];
+		auto& toTriangles = m_PositionTriangles[collapse.to];
+
+		const auto containsTarget = [&](const uint32_t* pTriangle)
+		{
+			return pTriangle[0] == collapse.to || pTriangle[1] == collapse.to || pTriangle[2] == collapse.to;
+		};
+
+		for (uint32_t t : fromTriangles)
+		{
+			const uint32_t* pTriangle = &m_Triangles[size_t(t) * 3];
+			if (m_TriangleRemoved[t] || containsTarget(pTriangle))
+			{
+				continue;
+			}
+
+			Vector3 before[3]{ m_Positions[pTriangle[0]], m_Positions[pTriangle[1]], m_Positions[pTriangle[2]] };
+			Vector3 after[3]{ before[0], before[1], before[2] };
+			for (int k{}; k < 3; ++k)
+			{
+				if (pTriangle[k] == collapse.from)
+				{
+					after[k] = m_Positions[collapse.to];
+				}
+			}
+
+			const Vector3 normalBefore = Vector3::Cross(before[1] - before[0], before[2] - before[0]);
+			const Vector3 normalAfter = Vector3::Cross(after[1] - after[0], after[2] - after[0]);
+
+			if (Vector3::Dot(normalBefore, normalAfter) <= MinNormalCosine * normalBefore.Magnitude() * normalAfter.Magnitude())
+			{
+				return false;
+			}
+		}
+
+		for (uint32_t t : fromTriangles)
+		{
+			uint32_t* pTriangle = &m_Triangles[size_t(t) * 3];
+			if (m_TriangleRemoved[t])
+			{
+				continue;
+			}
+
+			if (containsTarget(pTriangle))
+			{
+				m_TriangleRemoved[t] = true;
+				--m_TriangleCount;
+				continue;
+			}
+
+			std::replace(pTriangle, pTriangle + 3, collapse.from, collapse.to);
+			toTriangles.emplace_back(t);
+		}
+
+		m_Quadrics[collapse.to] += m_Quadrics[collapse.from];
+		m_PositionRemoved[collapse.from] = true;
+		fromTriangles.clear();
+		fromTriangles.shrink_to_fit();
+
+		std::erase_if(toTriangles, [this](uint32_t t) { return m_TriangleRemoved[t]; });
+		++m_PositionVersions[collapse.to];
+
+		PushCollapses(collapse.to);
+		return true;
+	}
+
+	uint32_t MeshSimplifier::FindClosestVertex(uint32_t position, uint32_t sourceVertex) const
+	{
+		const Vertex& source = m_Vertices[sourceVertex];
+
+		uint32_t closest = m_PositionVertices[position].front();
+		float closestScore = FLT_MAX;
+
+		for (uint32_t candidate : m_PositionVertices[position])
+		{
+			const Vertex& vertex = m_Vertices[candidate];
+			const float score = (1.f - Vector3::Dot(vertex.normal, source.normal)) + (vertex.uv - source.uv).SqrMagnitude();
+
+			if (score < closestScore)
+			{
+				closestScore = score;
+				closest = candidate;
+			}
+		}
+
+		return closest;
+	}
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdint>
+#include <queue>
+#include <vector>
+
+#include "DataTypes.h"
+
+namespace dae
+{
+	// Quadric error metric edge collapse (Garland & Heckbert), every call to Simplify
+	// continues from the previous result so a whole LOD chain costs a single pass.
+	class MeshSimplifier final
+	{
+	public:
+		MeshSimplifier(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices);
+
+		MeshSimplifier(const MeshSimplifier&) = delete;
+		MeshSimplifier(MeshSimplifier&&) noexcept = delete;
+		MeshSimplifier& operator=(const MeshSimplifier&) = delete;
+		MeshSimplifier& operator=(MeshSimplifier&&) noexcept = delete;
+
+		MeshLOD Simplify(size_t targetTriangleCount);
+		size_t GetTriangleCount() const { return m_TriangleCount; }
+
+		static void GenerateLODs(Mesh& mesh, uint32_t maxLODs = 4, float reductionPerLOD = 0.5f, size_t minTriangleCount = 256);
+
+	private:
+		struct Quadric
+		{
+			double xx{}, xy{}, xz{}, xw{}, yy{}, yz{}, yw{}, zz{}, zw{}, ww{};
+
+			void AddPlane(const Vector3& normal, float distance, float weight);
+			double Evaluate(const Vector3& p) const;
+			Quadric& operator+=(const Quadric& q);
+		};
+
+		struct Collapse
+		{
+			double cost{};
+			uint32_t from{};
+			uint32_t to{};
+			uint32_t fromVersion{};
+			uint32_t toVersion{};
+
+			bool operator<(const Collapse& other) const { return cost > other.cost; }
+		};
+
+		const std::vector<Vertex>& m_Vertices;
+
+		// Welded positions, collapses happen between these
+		std::vector<Vector3> m_Positions{};
+		std::vector<Quadric> m_Quadrics{};
+		std::vector<std::vector<uint32_t>> m_PositionTriangles{};
+		std::vector<std::vector<uint32_t>> m_PositionVertices{};
+		std::vector<uint32_t> m_PositionVersions{};
+		std::vector<bool> m_PositionRemoved{};
+
+		// Per vertex: welded position and the first vertex with identical attributes
+		std::vector<uint32_t> m_VertexPositions{};
+		std::vector<uint32_t> m_UniqueVertices{};
+
+		std::vector<uint32_t> m_Triangles{};
+		std::vector<uint32_t> m_Corners{};
+		std::vector<bool> m_TriangleRemoved{};
+		size_t m_TriangleCount{};
+
+		std::priority_queue<Collapse> m_Collapses{};
+		float m_Error{};
+
+		void PushCollapses(uint32_t position);
+		void PushCollapse(uint32_t from, uint32_t to);
+		bool TryCollapse(const Collapse& collapse);
+		uint32_t FindClosestVertex(uint32_t position, uint32_t sourceVertex) const;
+	};
+}
@@ -0,0 +1,129 @@
+#pragma once
+#include <immintrin.h>
+
+#include "ColorRGB.h"
+#include "Vector2.h"
+#include "Vector3.h"
+
+namespace dae
+{
+	// SoA math on 8 fragments at once, one AVX lane per fragment
+
+	inline __m256 Select(__m256 mask, __m256 a, __m256 b)
+	{
+		return _mm256_blendv_ps(b, a, mask);
+	}
+
+	inline __m256 Saturate(__m256 v)
+	{
+		return _mm256_min_ps(_mm256_max_ps(v, _mm256_setzero_ps()), _mm256_set1_ps(1.f));
+	}
+
+	// Cubic fit of the sRGB decode curve, off by at most 0.0017 over [0, 1]
+	inline __m256 SrgbToLinear(__m256 c)
+	{
+		__m256 p = _mm256_fmadd_ps(c, _mm256_set1_ps(0.305306011f), _mm256_set1_ps(0.682171111f));
+		p = _mm256_fmadd_ps(c, p, _mm256_set1_ps(0.012522878f));
+		return _mm256_mul_ps(c, p);
+	}
+
+	struct Vector2Packet
+	{
+		__m256 x{};
+		__m256 y{};
+	};
+
+	struct Vector3Packet
+	{
+		__m256 x{};
+		__m256 y{};
+		__m256 z{};
+
+		static Vector3Packet Broadcast(const Vector3& v)
+		{
+			return { _mm256_set1_ps(v.x), _mm256_set1_ps(v.y), _mm256_set1_ps(v.z) };
+		}
+
+		static __m256 Dot(const Vector3Packet& v1, const Vector3Packet& v2)
+		{
+			return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(v1.x, v2.x), _mm256_mul_ps(v1.y, v2.y)), _mm256_mul_ps(v1.z, v2.z));
+		}
+
+		static Vector3Packet Cross(const Vector3Packet& v1, const Vector3Packet& v2)
+		{
+			return {
+				_mm256_sub_ps(_mm256_mul_ps(v1.y, v2.z), _mm256_mul_ps(v1.z, v2.y)),
+				_mm256_sub_ps(_mm256_mul_ps(v1.z, v2.x), _mm256_mul_ps(v1.x, v2.z)),
+				_mm256_sub_ps(_mm256_mul_ps(v1.x, v2.y), _mm256_mul_ps(v1.y, v2.x))
+			};
+		}
+
+		Vector3Packet Normalized() const
+		{
+			const __m256 m = _mm256_sqrt_ps(Dot(*this, *this));
+			return { _mm256_div_ps(x, m), _mm256_div_ps(y, m), _mm256_div_ps(z, m) };
+		}
+
+		Vector3Packet operator+(const Vector3Packet& v) const
+		{
+			return { _mm256_add_ps(x, v.x), _mm256_add_ps(y, v.y), _mm256_add_ps(z, v.z) };
+		}
+
+		Vector3Packet operator-(const Vector3Packet& v) const
+		{
+			return { _mm256_sub_ps(x, v.x), _mm256_sub_ps(y, v.y), _mm256_sub_ps(z, v.z) };
+		}
+
+		Vector3Packet operator*(__m256 scale) const
+		{
+			return { _mm256_mul_ps(x, scale), _mm256_mul_ps(y, scale), _mm256_mul_ps(z, scale) };
+		}
+	};
+
+	struct ColorRGBPacket
+	{
+		__m256 r{};
+		__m256 g{};
+		__m256 b{};
+
+		static ColorRGBPacket Broadcast(const ColorRGB& c)
+		{
+			return { _mm256_set1_ps(c.r), _mm256_set1_ps(c.g), _mm256_set1_ps(c.b) };
+		}
+
+		void MaxToOne()
+		{
+			const __m256 maxValue = _mm256_max_ps(r, _mm256_max_ps(g, b));
+			const __m256 isOver = _mm256_cmp_ps(maxValue, _mm256_set1_ps(1.f), _CMP_GT_OQ);
+
+			r = Select(isOver, _mm256_div_ps(r, maxValue), r);
+			g = Select(isOver, _mm256_div_ps(g, maxValue), g);
+			b = Select(isOver, _mm256_div_ps(b, maxValue), b);
+		}
+
+		ColorRGBPacket Masked(__m256 mask) const
+		{
+			return { _mm256_and_ps(r, mask), _mm256_and_ps(g, mask), _mm256_and_ps(b, mask) };
+		}
+
+		ColorRGBPacket operator+(const ColorRGBPacket& c) const
+		{
+			return { _mm256_add_ps(r, c.r), _mm256_add_ps(g, c.g), _mm256_add_ps(b, c.b) };
+		}
+
+		ColorRGBPacket operator*(const ColorRGBPacket& c) const
+		{
+			return { _mm256_mul_ps(r, c.r), _mm256_mul_ps(g, c.g), _mm256_mul_ps(b, c.b) };
+		}
+
+		ColorRGBPacket operator*(__m256 s) const
+		{
+			return { _mm256_mul_ps(r, s), _mm256_mul_ps(g, s), _mm256_mul_ps(b, s) };
+		}
+
+		ColorRGBPacket operator/(__m256 s) const
+		{
+			return { _mm256_div_ps(r, s), _mm256_div_ps(g, s), _mm256_div_ps(b, s) };
+		}
+	};
+}
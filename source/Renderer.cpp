@@ -1,17 +1,137 @@
 //External includes
 #include "SDL.h"
+#include "SDL_image.h"
 #include "SDL_surface.h"
 
 //Project includes
 #include "Renderer.h"
+#include "FrameBuffer.h"
+#include "HdrBuffer.h"
 #include "Math.h"
 #include "Matrix.h"
+#include "MeshCache.h"
+#include "MeshSimplifier.h"
 #include "Texture.h"
 #include "Utils.h"
+#include "VertexPacking.h"
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cstring>
+#include <immintrin.h>
 #include <iostream>
+#include <memory>
+#include <random>
 
 using namespace dae;
 
+namespace
+{
+	// Row-major matrix broadcast for transforming 8 SoA vertices at once
+	struct MatrixBatch
+	{
+		__m256 m[4][4];
+
+		explicit MatrixBatch(const Matrix& matrix)
+		{
+			for (int r{}; r < 4; ++r)
+			{
+				const Vector4 row = matrix[r];
+				m[r][0] = _mm256_set1_ps(row.x);
+				m[r][1] = _mm256_set1_ps(row.y);
+				m[r][2] = _mm256_set1_ps(row.z);
+				m[r][3] = _mm256_set1_ps(row.w);
+			}
+		}
+
+		__m256 TransformVector(int column, __m256 x, __m256 y, __m256 z) const
+		{
+			return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, m[0][column]), _mm256_mul_ps(y, m[1][column])), _mm256_mul_ps(z, m[2][column]));
+		}
+
+		__m256 TransformPoint(int column, __m256 x, __m256 y, __m256 z) const
+		{
+			return _mm256_add_ps(TransformVector(column, x, y, z), m[3][column]);
+		}
+	};
+
+	// Position pass output of one batch in SoA, scattered into Vertex_Out afterwards
+	struct PositionBatch
+	{
+		alignas(32) float position[4][8];
+
+		void Project(const MatrixBatch& worldViewProjection, __m256 x, __m256 y, __m256 z, float width, float height)
+		{
+			const __m256 one = _mm256_set1_ps(1.f);
+			const __m256 w = worldViewProjection.TransformPoint(3, x, y, z);
+
+			_mm256_store_ps(position[0], _mm256_mul_ps(_mm256_add_ps(one, _mm256_div_ps(worldViewProjection.TransformPoint(0, x, y, z), w)), _mm256_set1_ps(width / 2.f)));
+			_mm256_store_ps(position[1], _mm256_mul_ps(_mm256_sub_ps(one, _mm256_div_ps(worldViewProjection.TransformPoint(1, x, y, z), w)), _mm256_set1_ps(height / 2.f)));
+			_mm256_store_ps(position[2], _mm256_div_ps(worldViewProjection.TransformPoint(2, x, y, z), w));
+			_mm256_store_ps(position[3], w);
+		}
+
+		void Store(size_t lane, Vertex_Out& v) const
+		{
+			v.position = { position[0][lane], position[1][lane], position[2][lane], position[3][lane] };
+		}
+	};
+
+	// Attribute pass output of one batch in SoA
+	struct AttributeBatch
+	{
+		alignas(32) float normal[3][8];
+		alignas(32) float tangent[3][8];
+
+		static void Transform(const MatrixBatch& world, __m256 x, __m256 y, __m256 z, float (&out)[3][8])
+		{
+			_mm256_store_ps(out[0], world.TransformVector(0, x, y, z));
+			_mm256_store_ps(out[1], world.TransformVector(1, x, y, z));
+			_mm256_store_ps(out[2], world.TransformVector(2, x, y, z));
+		}
+
+		void Store(size_t lane, Vertex_Out& v) const
+		{
+			v.normal = { normal[0][lane], normal[1][lane], normal[2][lane] };
+			v.tangent = { tangent[0][lane], tangent[1][lane], tangent[2][lane] };
+		}
+	};
+
+	void DecodeOctahedral(__m256i encoded, __m256& x, __m256& y, __m256& z)
+	{
+		const __m256 scale = _mm256_set1_ps(1.f / VertexPacking::SnormSteps);
+		const __m256 signMask = _mm256_set1_ps(-0.f);
+
+		x = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(encoded, 16), 16)), scale);
+		y = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(encoded, 16)), scale);
+		z = _mm256_sub_ps(_mm256_sub_ps(_mm256_set1_ps(1.f), _mm256_andnot_ps(signMask, x)), _mm256_andnot_ps(signMask, y));
+
+		// Unfold the lower hemisphere: x -= copysign(max(-z, 0), x)
+		const __m256 t = _mm256_max_ps(_mm256_xor_ps(z, signMask), _mm256_setzero_ps());
+		x = _mm256_sub_ps(x, _mm256_or_ps(t, _mm256_and_ps(x, signMask)));
+		y = _mm256_sub_ps(y, _mm256_or_ps(t, _mm256_and_ps(y, signMask)));
+
+		const __m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z)));
+		x = _mm256_div_ps(x, length);
+		y = _mm256_div_ps(y, length);
+		z = _mm256_div_ps(z, length);
+	}
+
+	// Perspective correct interpolation of one attribute across a fragment packet
+	Vector3Packet Interpolate(__m256 w0, __m256 w1, __m256 w2, __m256 depth, const Vector3& a0, const Vector3& a1, const Vector3& a2)
+	{
+		return (Vector3Packet::Broadcast(a0) * w0 + Vector3Packet::Broadcast(a1) * w1 + Vector3Packet::Broadcast(a2) * w2) * depth;
+	}
+
+	Vector2Packet Interpolate(__m256 w0, __m256 w1, __m256 w2, __m256 depth, const Vector2& a0, const Vector2& a1, const Vector2& a2)
+	{
+		return {
+			_mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(w0, _mm256_set1_ps(a0.x)), _mm256_mul_ps(w1, _mm256_set1_ps(a1.x))), _mm256_mul_ps(w2, _mm256_set1_ps(a2.x))), depth),
+			_mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(w0, _mm256_set1_ps(a0.y)), _mm256_mul_ps(w1, _mm256_set1_ps(a1.y))), _mm256_mul_ps(w2, _mm256_set1_ps(a2.y))), depth)
+		};
+	}
+}
+
 Renderer::Renderer(SDL_Window* pWindow) :
 	m_pWindow(pWindow)
 {
@@ -20,343 +140,1638 @@ Renderer::Renderer(SDL_Window* pWindow) :
 
 	//Create Buffers
 	m_pFrontBuffer = SDL_GetWindowSurface(pWindow);
-	m_pBackBuffer = SDL_CreateRGBSurface(0, m_Width, m_Height, 32, 0, 0, 0, 0);
-	m_pBackBufferPixels = (uint32_t*)m_pBackBuffer->pixels;
+	// Same layout as the window when we have a packer for it, so the blit is a plain copy
+	m_pBackBuffer = new FrameBuffer(m_Width, m_Height, FrameBuffer::FromSDLFormat(m_pFrontBuffer->format->format));
+	m_pHdrBuffer = new HdrBuffer(m_Width, m_Height, HdrPrecision::Half);
+
+	m_pDepthBufferPixels = new float[m_Width * m_Height];
+	m_RasterTarget = { m_pDepthBufferPixels, m_Width, m_Height };
+	m_ShadowMap.resize(ShadowMapSize * ShadowMapSize);
+
+	m_TileCountX = (m_Width + TileSize - 1) / TileSize;
+	m_TileCountY = (m_Height + TileSize - 1) / TileSize;
+
+	m_ViewDirectionStride = (m_Width + 7) & ~7;
+	m_ViewDirectionsX.resize(m_ViewDirectionStride * m_Height);
+	m_ViewDirectionsY.resize(m_ViewDirectionStride * m_Height);
+	m_ViewDirectionsZ.resize(m_ViewDirectionStride * m_Height);
+
+	//Initialize Camera
+	auto aspectRatio = static_cast<float>(m_Width) / m_Height;
+	m_Camera.Initialize(aspectRatio, 45.f, { .0f, 0.0f, 0.0f });
+
+	// Assets load on the thread pool and the constructor only waits for the mesh, the mesh goes first
+	std::future<Mesh> vehicleMesh = m_ThreadPool.Submit([this]
+	{
+		Mesh vehicle{};
+		vehicle.primitiveTopology = PrimitiveTopology::TriangleList;
+		vehicle.materialIndex = 0;
+
+		// The first run imports the OBJ and writes the finished mesh next to it, later runs map that back
+		const MeshCache::BuildSettings settings{};
+		if (!MeshCache::Load("Resources/vehicle.obj", settings, vehicle))
+		{
+			// The chunks of the parse go to whichever workers aren't busy with a texture
+			Utils::ParseOBJ("Resources/vehicle.obj", vehicle.vertices, vehicle.indices, settings.flipAxisAndWinding, &m_ThreadPool);
+			Utils::CalculateBounds(vehicle.vertices, vehicle.minBounds, vehicle.maxBounds);
+			MeshSimplifier::GenerateLODs(vehicle, settings.maxLODs, settings.reductionPerLOD, settings.minTriangleCount);
+			VertexPacking::PackMesh(vehicle);
+			MeshCache::Write("Resources/vehicle.obj", settings, vehicle);
+		}
+
+		return vehicle;
+	});
+
+	// Initialize materials, flat until their textures arrive. A missing packed material samples the maps
+	m_PlaceholderTextures = {
+		Texture::CreateSolid(colors::Gray),
+		// Straight out of the surface
+		Texture::CreateSolid(ColorRGB{ .5f, .5f, 1.f }),
+		Texture::CreateSolid(colors::Gray),
+		Texture::CreateSolid(colors::Black)
+	};
+	Material& vehicleMaterial = m_Materials.emplace_back();
+	vehicleMaterial.pDiffuse = m_PlaceholderTextures[0];
+	vehicleMaterial.pNormal = m_PlaceholderTextures[1];
+	vehicleMaterial.pGloss = m_PlaceholderTextures[2];
+	vehicleMaterial.pSpecular = m_PlaceholderTextures[3];
+
+	// SDL_image loads its PNG decoder lazily and without a lock, load it here before the workers decode
+	IMG_Init(IMG_INIT_PNG);
+
+	// Load textures, block compressed. A map that fails to load keeps its placeholder, nothing a task throws
+	// may reach the futures: those are only read in Update and teardown
+	const std::string vehicleMaps[]{ "Resources/vehicle_diffuse.png", "Resources/vehicle_normal.png", "Resources/vehicle_gloss.png", "Resources/vehicle_specular.png" };
+	constexpr TextureStorage vehicleStorages[]{ TextureStorage::BC1, TextureStorage::BC5, TextureStorage::BC4, TextureStorage::BC1 };
+	const Texture* Material::* const vehicleSlots[]{ &Material::pDiffuse, &Material::pNormal, &Material::pGloss, &Material::pSpecular };
+	std::array<std::shared_future<Texture*>, 4> vehicleTextures{};
+	for (int i{}; i < 4; ++i)
+	{
+		vehicleTextures[i] = m_ThreadPool.Submit([path = vehicleMaps[i], storage = vehicleStorages[i]]() -> Texture*
+		{
+			try
+			{
+				return Texture::LoadFromFile(path, storage);
+			}
+			catch (const std::exception& exception)
+			{
+				std::cout << "Failed to load " << path << ": " << exception.what() << "\n";
+				return nullptr;
+			}
+		}).share();
+	}
+
+	// Packed from the same maps, so every PNG is decoded once. Submitted after them, as a task may only wait on
+	// tasks submitted before it
+	std::shared_future<Texture*> packedMaterial = m_ThreadPool.Submit([vehicleTextures, shine = vehicleMaterial.shine]() -> Texture*
+	{
+		if (!std::all_of(vehicleTextures.begin(), vehicleTextures.end(), [](const std::shared_future<Texture*>& map) { return map.get() != nullptr; }))
+		{
+			return nullptr;
+		}
+
+		try
+		{
+			std::unique_ptr<Texture> pPacked{ Texture::PackMaterial(*vehicleTextures[0].get(), *vehicleTextures[1].get(), *vehicleTextures[2].get(), *vehicleTextures[3].get(), shine) };
+			pPacked->MakeVirtual(MaterialPageBudget);
+			return pPacked.release();
+		}
+		catch (const std::exception& exception)
+		{
+			std::cout << "Failed to pack the vehicle material: " << exception.what() << "\n";
+			return nullptr;
+		}
+	}).share();
+	m_PendingTextures.push_back({ packedMaterial, 0, &Material::pPacked });
+
+	// Paged for the unpacked path once the packing is done reading them
+	for (int i{}; i < 4; ++i)
+	{
+		std::shared_future<Texture*> texture = m_ThreadPool.Submit([map = vehicleTextures[i], packedMaterial, path = vehicleMaps[i]]() -> Texture*
+		{
+			packedMaterial.wait();
+
+			Texture* pTexture = map.get();
+			if (pTexture)
+			{
+				try
+				{
+					pTexture->MakeVirtual(TexturePageBudget);
+				}
+				catch (const std::exception& exception)
+				{
+					std::cout << "Failed to page " << path << ": " << exception.what() << "\n";
+					delete pTexture;
+					return nullptr;
+				}
+			}
+			return pTexture;
+		}).share();
+		m_PendingTextures.push_back({ std::move(texture), 0, vehicleSlots[i] });
+	}
+
+	float maxShine{};
+	for (const Material& material : m_Materials)
+	{
+		maxShine = std::max(maxShine, material.shine);
+	}
+	m_PowTable = PowTable{ maxShine };
+
+	// Initialize mesh
+	m_Meshes.push_back(vehicleMesh.get());
+
+	m_MeshInstances.push_back({ Matrix::CreateTranslation(0.f, 0.f, 50.f) });
+	SortDraws();
+
+	// Initialize lights
+	m_Lights.push_back({ LightType::Directional, {}, Vector3{ .577f, -.577f, .577f }, colors::White, 7.f });
+	m_Lights.back().castsShadows = true;
+	SortLights();
+}
+
+Renderer::~Renderer()
+{
+	delete m_pBackBuffer;
+	delete m_pHdrBuffer;
+	delete[] m_pDepthBufferPixels;
+	for (Texture* pTexture : m_Textures)
+	{
+		delete pTexture;
+	}
+	for (Texture* pTexture : m_PlaceholderTextures)
+	{
+		delete pTexture;
+	}
+	// Waits for the loads still running
+	for (PendingTexture& pending : m_PendingTextures)
+	{
+		delete pending.texture.get();
+	}
+
+	IMG_Quit();
+}
+
+void Renderer::Update(Timer* pTimer)
+{
+	AdoptLoadedTextures();
+
+	m_Camera.Update(pTimer);
+
+	if (m_Camera.hasChanged)
+	{
+		UpdateViewRays();
+		m_Camera.hasChanged = false;
+	}
+
+	if (m_RotateMesh)
+	{
+		m_MeshRotation += pTimer->GetElapsed();
+
+		for (auto& instance : m_MeshInstances)
+		{
+			instance.worldMatrix = Matrix::CreateRotationY(m_MeshRotation) * Matrix::CreateTranslation(instance.worldMatrix.GetTranslation());
+		}
+	}
+}
+
+void Renderer::Render()
+{
+	// Lock BackBuffer
+	SDL_LockSurface(m_pBackBuffer->GetSurface());
+
+	// Clear BackBuffer
+	m_pBackBuffer->Clear(ColorRGB{ 100.f, 100.f, 100.f } / 255.f);
+
+	// Initialize Depth buffer
+	std::fill_n(m_pDepthBufferPixels, m_Width * m_Height, std::numeric_limits<float>::max());
+
+	UpdateShadowMap();
+
+	// Instances are sorted, so every run of one mesh is a single draw and draws sharing a material are adjacent
+	const auto renderAll = [this](bool depthOnly)
+	{
+		const std::span<MeshInstance> instances{ m_MeshInstances };
+
+		for (size_t first{}; first < instances.size();)
+		{
+			size_t last{ first + 1 };
+			while (last < instances.size() && instances[last].meshIndex == instances[first].meshIndex)
+			{
+				++last;
+			}
+
+			RenderInstanced(m_Meshes[instances[first].meshIndex], instances.subspan(first, last - first), depthOnly);
+			first = last;
+		}
+	};
+
+	if (!m_LocalLights.empty())
+	{
+		// Depth prepass: tiles need their depth range before lights get assigned, and the
+		// shading pass after it only ever shades the visible fragment of each pixel
+		renderAll(true);
+		BuildTileLightLists();
+	}
+
+	renderAll(false);
+
+	if (m_UseHdr && !m_DepthBufferVisualization)
+	{
+		m_pHdrBuffer->Resolve(*m_pBackBuffer, m_pDepthBufferPixels, m_Exposure, m_ToneMapper);
+	}
+
+	// Pages asked for by this frame's samples show up in the next one
+	for (Texture* pTexture : m_Textures)
+	{
+		pTexture->UpdatePages();
+	}
+
+	//@END
+	//Update SDL Surface
+	SDL_UnlockSurface(m_pBackBuffer->GetSurface());
+	SDL_BlitSurface(m_pBackBuffer->GetSurface(), 0, m_pFrontBuffer, 0);
+	SDL_UpdateWindowSurface(m_pWindow);
+}
+
+void Renderer::RenderInstanced(const Mesh& mesh, std::span<MeshInstance> instances, bool depthOnly)
+{
+	// Switching materials is a pointer and a raster function, the textures are only touched by the shading
+	m_pMaterial = &m_Materials[mesh.materialIndex];
+	const RasterFunction rasterFunction = GetRasterFunction(depthOnly);
+	// Packed meshes no longer have float vertices
+	const bool isPacked = mesh.IsPacked();
+
+	for (auto& instance : instances)
+	{
+		const Matrix worldViewProjectionMatrix{ instance.worldMatrix * m_Camera.viewMatrix * m_Camera.projectionMatrix };
+
+		if (!IsInsideFrustum(mesh, worldViewProjectionMatrix))
+		{
+			continue;
+		}
+
+		SelectLOD(mesh, instance);
+
+		// Positions first, the remaining attributes only for vertices of triangles that survive culling
+		if (isPacked)
+		{
+			TransformPositions(mesh.GetPackedVertices(instance.lodIndex), mesh.minBounds, mesh.maxBounds, worldViewProjectionMatrix);
+		}
+		else
+		{
+			TransformPositions(mesh.GetVertices(instance.lodIndex), worldViewProjectionMatrix);
+		}
+
+		if (!CullTriangles(mesh, instance.lodIndex))
+		{
+			continue;
+		}
+
+		if (!depthOnly && isPacked)
+		{
+			TransformAttributes(mesh.GetPackedVertices(instance.lodIndex), instance.worldMatrix);
+		}
+		else if (!depthOnly)
+		{
+			TransformAttributes(mesh.GetVertices(instance.lodIndex), instance.worldMatrix);
+		}
+
+		for (size_t i{}; i < m_VisibleIndices.size(); i += 3)
+		{
+			(this->*rasterFunction)(m_VerticesOut[m_VisibleIndices[i]], m_VerticesOut[m_VisibleIndices[i + 1]], m_VerticesOut[m_VisibleIndices[i + 2]]);
+		}
+	}
+}
+
+void Renderer::TransformPositions(std::span<const Vertex> vertices, const Matrix& worldViewProjectionMatrix)
+{
+	m_VerticesOut.resize(vertices.size());
+
+	const MatrixBatch worldViewProjection{ worldViewProjectionMatrix };
+
+	// Vertices are AoS, gather 8 of them at a time into SoA registers
+	const __m256i stride = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(sizeof(Vertex) / sizeof(float)));
+	const auto gather = [&stride](const float* pBase)
+	{
+		return _mm256_i32gather_ps(pBase, stride, sizeof(float));
+	};
+
+	size_t i{};
+	for (; i + 8 <= vertices.size(); i += 8)
+	{
+		const Vertex& first = vertices[i];
+		PositionBatch batch;
+
+		batch.Project(worldViewProjection, gather(&first.position.x), gather(&first.position.y), gather(&first.position.z), float(m_RasterTarget.width), float(m_RasterTarget.height));
+
+		for (size_t j{}; j < 8; ++j)
+		{
+			batch.Store(j, m_VerticesOut[i + j]);
+		}
+	}
+
+	for (; i < vertices.size(); ++i)
+	{
+		TransformPosition(vertices[i].position, worldViewProjectionMatrix, m_VerticesOut[i]);
+	}
+}
+
+void Renderer::TransformPositions(const PackedVertexView& stream, const Vector3& minBounds, const Vector3& maxBounds, const Matrix& worldViewProjectionMatrix)
+{
+	const auto& vertices = stream.vertices;
+	m_VerticesOut.resize(vertices.size());
+
+	// Dequantization is folded into the matrix, quantized positions go straight to clip space
+	const Matrix dequantizeMatrix{ Matrix::CreateScale((maxBounds - minBounds) / VertexPacking::PositionSteps) * Matrix::CreateTranslation(minBounds) };
+	const MatrixBatch worldViewProjection{ dequantizeMatrix * worldViewProjectionMatrix };
+
+	const __m256i stride = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(sizeof(PackedVertex)));
+	const __m256i lowMask = _mm256_set1_epi32(0xFFFF);
+
+	size_t i{};
+	for (; i + 8 <= vertices.size(); i += 8)
+	{
+		const char* pFirst = reinterpret_cast<const char*>(&vertices[i]);
+		PositionBatch batch;
+
+		const __m256i xy = _mm256_i32gather_epi32(reinterpret_cast<const int*>(pFirst + offsetof(PackedVertex, position)), stride, 1);
+		const __m256i z = _mm256_i32gather_epi32(reinterpret_cast<const int*>(pFirst + offsetof(PackedVertex, position) + 2 * sizeof(uint16_t)), stride, 1);
+
+		batch.Project(worldViewProjection,
+			_mm256_cvtepi32_ps(_mm256_and_si256(xy, lowMask)),
+			_mm256_cvtepi32_ps(_mm256_srli_epi32(xy, 16)),
+			_mm256_cvtepi32_ps(_mm256_and_si256(z, lowMask)),
+			float(m_RasterTarget.width), float(m_RasterTarget.height));
+
+		for (size_t j{}; j < 8; ++j)
+		{
+			batch.Store(j, m_VerticesOut[i + j]);
+		}
+	}
+
+	for (; i < vertices.size(); ++i)
+	{
+		TransformPosition(VertexPacking::Unpack(vertices[i], 0xFFFFFFFF, minBounds, maxBounds).position, worldViewProjectionMatrix, m_VerticesOut[i]);
+	}
+}
+
+bool Renderer::CullTriangles(const Mesh& mesh, uint32_t lodIndex)
+{
+	const auto& indices = mesh.GetIndices(lodIndex);
+
+	m_VisibleIndices.clear();
+	// One bit per vertex, a byte covers one attribute batch
+	m_VertexVisibility.assign((m_VerticesOut.size() + 7) / 8, 0);
+
+	const auto addTriangle = [this](uint32_t i0, uint32_t i1, uint32_t i2)
+	{
+		if (!IsTriangleVisible(m_VerticesOut[i0], m_VerticesOut[i1], m_VerticesOut[i2]))
+		{
+			return;
+		}
+
+		for (uint32_t i : { i0, i1, i2 })
+		{
+			m_VisibleIndices.emplace_back(i);
+			m_VertexVisibility[i / 8] |= uint8_t(1 << (i % 8));
+		}
+	};
+
+	if (mesh.primitiveTopology == PrimitiveTopology::TriangleList)
+	{
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			addTriangle(indices[i], indices[i + 1], indices[i + 2]);
+		}
+	}
+	else if (mesh.primitiveTopology == PrimitiveTopology::TriangleStrip)
+	{
+		for (size_t i = 0; i + 2 < indices.size(); ++i)
+		{
+			// try optimize without if statement, either 2 for loops or just adding/substracting the result of the modulo directly
+			if (i % 2)
+			{
+				addTriangle(indices[i], indices[i + 2], indices[i + 1]);
+			}
+			else
+			{
+				addTriangle(indices[i], indices[i + 1], indices[i + 2]);
+			}
+		}
+	}
+
+	return !m_VisibleIndices.empty();
+}
+
+void Renderer::TransformAttributes(std::span<const Vertex> vertices, const Matrix& worldMatrix)
+{
+	const MatrixBatch world{ worldMatrix };
+
+	const __m256i stride = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(sizeof(Vertex) / sizeof(float)));
+	const auto gather = [&stride](const float* pBase)
+	{
+		return _mm256_i32gather_ps(pBase, stride, sizeof(float));
+	};
+
+	for (size_t batchIndex{}; batchIndex < m_VertexVisibility.size(); ++batchIndex)
+	{
+		const uint8_t visibility = m_VertexVisibility[batchIndex];
+		const size_t i = batchIndex * 8;
+
+		if (visibility == 0)
+		{
+			continue;
+		}
+
+		// A batch with any visible vertex is cheaper to do whole than lane by lane
+		if (i + 8 > vertices.size())
+		{
+			for (size_t j{}; i + j < vertices.size(); ++j)
+			{
+				if (visibility & (1 << j))
+				{
+					TransformAttributes(vertices[i + j], worldMatrix, m_VerticesOut[i + j]);
+				}
+			}
+			continue;
+		}
+
+		const Vertex& first = vertices[i];
+		AttributeBatch batch;
+
+		AttributeBatch::Transform(world, gather(&first.normal.x), gather(&first.normal.y), gather(&first.normal.z), batch.normal);
+		AttributeBatch::Transform(world, gather(&first.tangent.x), gather(&first.tangent.y), gather(&first.tangent.z), batch.tangent);
+
+		for (size_t j{}; j < 8; ++j)
+		{
+			Vertex_Out& v = m_VerticesOut[i + j];
+			batch.Store(j, v);
+			v.color = vertices[i + j].color;
+			v.uv = vertices[i + j].uv;
+		}
+	}
+}
+
+void Renderer::TransformAttributes(const PackedVertexView& stream, const Matrix& worldMatrix)
+{
+	const auto& vertices = stream.vertices;
+	const MatrixBatch world{ worldMatrix };
+
+	const __m256i stride = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(sizeof(PackedVertex)));
+	const auto gather = [&stride](const PackedVertex* pFirst, size_t offset)
+	{
+		return _mm256_i32gather_epi32(reinterpret_cast<const int*>(reinterpret_cast<const char*>(pFirst) + offset), stride, 1);
+	};
+
+	const __m256i lowMask = _mm256_set1_epi32(0xFFFF);
+
+	for (size_t batchIndex{}; batchIndex < m_VertexVisibility.size(); ++batchIndex)
+	{
+		const uint8_t visibility = m_VertexVisibility[batchIndex];
+		const size_t i = batchIndex * 8;
+
+		if (visibility == 0)
+		{
+			continue;
+		}
+
+		if (i + 8 > vertices.size())
+		{
+			for (size_t j{}; i + j < vertices.size(); ++j)
+			{
+				if (visibility & (1 << j))
+				{
+					const uint32_t color = stream.colors.empty() ? 0xFFFFFFFF : stream.colors[i + j];
+					TransformAttributes(VertexPacking::Unpack(vertices[i + j], color, Vector3::Zero, Vector3::Zero), worldMatrix, m_VerticesOut[i + j]);
+				}
+			}
+			continue;
+		}
+
+		const PackedVertex* pFirst = &vertices[i];
+		AttributeBatch batch;
+
+		__m256 x, y, z;
+		DecodeOctahedral(gather(pFirst, offsetof(PackedVertex, normal)), x, y, z);
+		AttributeBatch::Transform(world, x, y, z, batch.normal);
+
+		DecodeOctahedral(gather(pFirst, offsetof(PackedVertex, tangent)), x, y, z);
+		AttributeBatch::Transform(world, x, y, z, batch.tangent);
+
+		// Pack the 8 u and 8 v halves next to each other and widen them in one go
+		const __m256i uv = gather(pFirst, offsetof(PackedVertex, uv));
+		const __m256i halves = _mm256_permute4x64_epi64(_mm256_packus_epi32(_mm256_and_si256(uv, lowMask), _mm256_srli_epi32(uv, 16)), _MM_SHUFFLE(3, 1, 2, 0));
+		alignas(32) float u[8], v[8];
+		_mm256_store_ps(u, _mm256_cvtph_ps(_mm256_castsi256_si128(halves)));
+		_mm256_store_ps(v, _mm256_cvtph_ps(_mm256_extracti128_si256(halves, 1)));
+
+		for (size_t j{}; j < 8; ++j)
+		{
+			Vertex_Out& out = m_VerticesOut[i + j];
+			batch.Store(j, out);
+			out.uv = { u[j], v[j] };
+			out.color = stream.colors.empty() ? colors::White : VertexPacking::UnpackColor(stream.colors[i + j]);
+		}
+	}
+}
+
+void Renderer::TransformPosition(const Vector3& position, const Matrix& worldViewProjectionMatrix, Vertex_Out& v) const
+{
+	v.position = worldViewProjectionMatrix.TransformPoint({ position, 1.f });
+
+	v.position.x /= v.position.w;
+	v.position.y /= v.position.w;
+	v.position.z /= v.position.w;
+
+	v.position.x = ((1.f + v.position.x) / 2.f) * m_RasterTarget.width;
+	v.position.y = ((1.f - v.position.y) / 2.f) * m_RasterTarget.height;
+}
+
+void Renderer::TransformAttributes(const Vertex& vertex, const Matrix& worldMatrix, Vertex_Out& v) const
+{
+	v.color = vertex.color;
+	v.uv = vertex.uv;
+	v.normal = worldMatrix.TransformVector(vertex.normal);
+	v.tangent = worldMatrix.TransformVector(vertex.tangent);
+}
+
+bool Renderer::SaveBufferToImage() const
+{
+	return SDL_SaveBMP(m_pBackBuffer->GetSurface(), "Rasterizer_ColorBuffer.bmp");
+}
+
+void Renderer::ToggleDepthBufferVisualization()
+{
+	m_DepthBufferVisualization = !m_DepthBufferVisualization;
+	std::cout << "Toggled Depth Visualization To: " << m_DepthBufferVisualization << "\n";
+}
+
+void Renderer::ToggleMeshRotation()
+{
+	m_RotateMesh = !m_RotateMesh;
+	std::cout << "Toggled Mesh Rotation To: " << m_RotateMesh << "\n";
+}
+
+void Renderer::ToggleNormalMap()
+{
+	m_UseNormalMap = !m_UseNormalMap;
+	std::cout << "Toggled Normal Map To: " << m_UseNormalMap << "\n";
+}
+
+void Renderer::CycleLightingMode()
+{
+	m_LightingMode = LightingMode(((int)m_LightingMode + 1) % (int)LightingMode::End);
+
+	std::cout << "Toggled Lighting Mode To: " << (int)m_LightingMode << "\n";
+}
+
+void Renderer::CycleSpecularPower()
+{
+	m_PowMode = PowMode(((int)m_PowMode + 1) % (int)PowMode::End);
+
+	std::cout << "Toggled Specular Power To: " << FastPow::GetName(m_PowMode) << "\n";
+}
+
+void Renderer::PrintBenchmarks() const
+{
+	for (int mode{}; mode < int(PowMode::End); ++mode)
+	{
+		std::cout << "Specular power error of " << FastPow::GetName(PowMode(mode)) << ":\n";
+		FastPow::PrintErrorReport(PowMode(mode), m_PowTable);
+	}
+
+	// The renderer's maps are block compressed and paged, which have a single layout. The report reorders
+	// a resident RGBA8 copy of the diffuse map instead
+	if (const Texture* pDiffuse = Texture::LoadFromFile("Resources/vehicle_diffuse.png"))
+	{
+		std::cout << "Texture layouts of vehicle_diffuse.png:\n";
+		Texture::PrintLayoutReport(*pDiffuse);
+		delete pDiffuse;
+	}
+}
+
+void Renderer::ToggleNightLights()
+{
+	m_NightLights = !m_NightLights;
+	m_Lights.clear();
+
+	if (m_NightLights)
+	{
+		// Dim moonlight plus street lights spread over the traffic grid, same layout every time
+		m_Lights.push_back({ LightType::Directional, {}, Vector3{ .577f, -.577f, .577f }, ColorRGB{ 0.6f, 0.7f, 1.f }, 0.5f });
+		m_Lights.back().castsShadows = true;
+
+		std::mt19937 generator{ 1337 };
+		std::uniform_real_distribution<float> x{ -110.f, 110.f };
+		std::uniform_real_distribution<float> y{ 6.f, 14.f };
+		std::uniform_real_distribution<float> z{ 25.f, 150.f };
+		std::uniform_real_distribution<float> channel{ 0.2f, 1.f };
+
+		for (int i{}; i < 256; ++i)
+		{
+			Light light{};
+			light.type = i % 4 == 0 ? LightType::Spot : LightType::Point;
+			light.position = { x(generator), y(generator), z(generator) };
+			light.direction = -Vector3::UnitY;
+			light.color = { channel(generator), channel(generator), channel(generator) };
+			light.intensity = 1000.f;
+			light.specularIntensity = light.intensity;
+			light.range = 20.f;
+
+			if (light.type == LightType::Spot)
+			{
+				// Lamp posts above the cars shining down
+				light.position.y += 10.f;
+				light.intensity = 4000.f;
+				light.specularIntensity = light.intensity;
+				light.range = 40.f;
+			}
+
+			m_Lights.push_back(light);
+		}
+	}
+	else
+	{
+		m_Lights.push_back({ LightType::Directional, {}, Vector3{ .577f, -.577f, .577f }, colors::White, 7.f });
+		m_Lights.back().castsShadows = true;
+	}
+
+	SortLights();
+
+	std::cout << "Toggled Night Lights To: " << m_NightLights << " (" << m_Lights.size() << " lights)\n";
+}
+
+void Renderer::ToggleShadows()
+{
+	m_UseShadows = !m_UseShadows;
+	std::cout << "Toggled Shadows To: " << m_UseShadows << "\n";
+}
+
+void Renderer::ToggleHdr()
+{
+	m_UseHdr = !m_UseHdr;
+	std::cout << "Toggled HDR To: " << m_UseHdr << "\n";
+}
+
+void Renderer::ToggleMipmaps()
+{
+	m_UseMipmaps = !m_UseMipmaps;
+	std::cout << "Toggled Mipmaps To: " << m_UseMipmaps << "\n";
+}
+
+void Renderer::CycleTextureFilter()
+{
+	m_TextureFilter = TextureFilter((int(m_TextureFilter) + 1) % int(TextureFilter::End));
+	std::cout << "Toggled Texture Filter To: " << Texture::GetName(m_TextureFilter) << "\n";
+}
+
+void Renderer::TogglePackedMaterials()
+{
+	m_UsePackedMaterials = !m_UsePackedMaterials;
+	std::cout << "Toggled Packed Materials To: " << m_UsePackedMaterials << "\n";
+}
+
+void Renderer::CycleToneMapper()
+{
+	m_ToneMapper = ToneMapper((int(m_ToneMapper) + 1) % int(ToneMapper::End));
+	std::cout << "Toggled Tone Mapper To: " << HdrBuffer::GetName(m_ToneMapper) << "\n";
+}
+
+void Renderer::ToggleLOD()
+{
+	m_UseLOD = !m_UseLOD;
+	std::cout << "Toggled LOD To: " << m_UseLOD << "\n";
+}
+
+void Renderer::ToggleTraffic()
+{
+	m_ShowTraffic = !m_ShowTraffic;
+	m_MeshInstances.clear();
+
+	if (m_ShowTraffic)
+	{
+		// Rows reaching past the far plane exercise the instance culling
+		for (int row{}; row < 4; ++row)
+		{
+			for (int column{ -3 }; column <= 3; ++column)
+			{
+				m_MeshInstances.push_back({ Matrix::CreateTranslation(column * 30.f, 0.f, 50.f + row * 30.f) });
+			}
+		}
+	}
+	else
+	{
+		m_MeshInstances.push_back({ Matrix::CreateTranslation(0.f, 0.f, 50.f) });
+	}
+
+	SortDraws();
+	std::cout << "Toggled Traffic To: " << m_ShowTraffic << " (" << m_MeshInstances.size() << " instances)\n";
+}
+
+// Private functions
+
+template<int... Indices>
+constexpr std::array<Renderer::RasterFunction, sizeof...(Indices)> Renderer::MakeRasterFunctions(std::integer_sequence<int, Indices...>)
+{
+	return { &Renderer::RenderTriangle<GetPipelineState(Indices)>... };
+}
+
+Renderer::RasterFunction Renderer::GetRasterFunction(bool depthOnly) const
+{
+	// Every pipeline state gets its own instantiation, picked once per draw
+	static constexpr std::array<RasterFunction, RasterFunctionCount> rasterFunctions{ MakeRasterFunctions(std::make_integer_sequence<int, RasterFunctionCount>{}) };
+
+	if (depthOnly)
+	{
+		return &Renderer::RenderTriangle<PipelineState{ LightingMode::ObservedArea, false, false, PowMode::Exact, true }>;
+	}
+
+	if (m_DepthBufferVisualization)
+	{
+		return &Renderer::RenderTriangle<PipelineState{ LightingMode::Combined, false, true, PowMode::Exact }>;
+	}
+
+	const bool useNormalMap = m_UseNormalMap && m_pMaterial->useNormalMap && m_pMaterial->pNormal;
+	const bool usePackedMaterial = m_UsePackedMaterials && m_pMaterial->pPacked;
+	const int index = ((int(m_LightingMode) * 2 + int(useNormalMap)) * int(PowMode::End) + int(m_PowMode)) * 2 + int(m_UseHdr);
+	return rasterFunctions[(index * 2 + int(usePackedMaterial)) * 2 + int(m_UseMipmaps)];
+}
+
+void Renderer::SortDraws()
+{
+	std::stable_sort(m_MeshInstances.begin(), m_MeshInstances.end(), [this](const MeshInstance& a, const MeshInstance& b)
+		{
+			const uint32_t materialA = m_Meshes[a.meshIndex].materialIndex;
+			const uint32_t materialB = m_Meshes[b.meshIndex].materialIndex;
+			return materialA != materialB ? materialA < materialB : a.meshIndex < b.meshIndex;
+		});
+}
+
+void Renderer::SortLights()
+{
+	m_DirectionalLights.clear();
+	m_LocalLights.clear();
+
+	for (uint32_t i{}; i < m_Lights.size(); ++i)
+	{
+		if (m_Lights[i].type == LightType::Directional)
+		{
+			m_DirectionalLights.push_back(i);
+		}
+		else
+		{
+			m_LocalLights.push_back(i);
+		}
+	}
+
+	m_TileLightOffsets.clear();
+	m_TileLightIndices.clear();
+}
+
+void Renderer::BuildTileLightLists()
+{
+	const int tileCount = m_TileCountX * m_TileCountY;
+	const float near = m_Camera.near;
+	const float far = m_Camera.far;
+
+	// View space depth range of the fragments in each tile, empty tiles keep an inverted range
+	std::vector<Vector2> tileDepthRanges(tileCount, Vector2{ FLT_MAX, -FLT_MAX });
+
+	for (int py{}; py < m_Height; ++py)
+	{
+		for (int px{}; px < m_Width; ++px)
+		{
+			const float depthBuffer = m_pDepthBufferPixels[px + py * m_Width];
+			if (depthBuffer > 1.f)
+			{
+				continue;
+			}
+
+			Vector2& range = tileDepthRanges[(py / TileSize) * m_TileCountX + px / TileSize];
+			range.x = std::min(range.x, depthBuffer);
+			range.y = std::max(range.y, depthBuffer);
+		}
+	}
+
+	for (Vector2& range : tileDepthRanges)
+	{
+		if (range.x <= range.y)
+		{
+			// Undo the projection's z remap
+			range.x = near * far / (far - range.x * (far - near));
+			range.y = near * far / (far - range.y * (far - near));
+		}
+	}
+
+	// Sphere vs the 4 side planes of a tile's frustum: x >= k * z with k the view space slope at the tile edge
+	const auto isInsideSlab = [](float center, float depth, float radius, float minSlope, float maxSlope)
+	{
+		return center - minSlope * depth >= -radius * sqrtf(1.f + minSlope * minSlope) &&
+			maxSlope * depth - center >= -radius * sqrtf(1.f + maxSlope * maxSlope);
+	};
+	const auto slopeX = [this](int px) { return (2.f * px / m_Width - 1.f) * m_Camera.aspectRatio * m_Camera.fov; };
+	const auto slopeY = [this](int py) { return (1.f - 2.f * py / m_Height) * m_Camera.fov; };
+
+	struct LightTiles
+	{
+		uint32_t lightIndex;
+		int minX, maxX, minY, maxY;
+		float minDepth, maxDepth;
+	};
+	std::vector<LightTiles> lightTiles{};
+	lightTiles.reserve(m_LocalLights.size());
+
+	for (uint32_t lightIndex : m_LocalLights)
+	{
+		const Light& light = m_Lights[lightIndex];
+		const Vector3 center = m_Camera.viewMatrix.TransformPoint(light.position);
+		const float radius = light.range;
+
+		if (center.z + radius < near || center.z - radius > far)
+		{
+			continue;
+		}
+
+		// Slab tests are independent per axis, find the covered tile rectangle first
+		LightTiles tiles{ lightIndex, m_TileCountX, -1, m_TileCountY, -1, center.z - radius, center.z + radius };
+
+		for (int tx{}; tx < m_TileCountX; ++tx)
+		{
+			if (isInsideSlab(center.x, center.z, radius, slopeX(tx * TileSize), slopeX((tx + 1) * TileSize)))
+			{
+				tiles.minX = std::min(tiles.minX, tx);
+				tiles.maxX = tx;
+			}
+		}
+		for (int ty{}; ty < m_TileCountY; ++ty)
+		{
+			// Screen y grows downwards, view space y upwards
+			if (isInsideSlab(center.y, center.z, radius, slopeY((ty + 1) * TileSize), slopeY(ty * TileSize)))
+			{
+				tiles.minY = std::min(tiles.minY, ty);
+				tiles.maxY = ty;
+			}
+		}
+
+		if (tiles.minX <= tiles.maxX && tiles.minY <= tiles.maxY)
+		{
+			lightTiles.push_back(tiles);
+		}
+	}
+
+	const auto forEachTile = [&](const LightTiles& tiles, const auto& function)
+	{
+		for (int ty{ tiles.minY }; ty <= tiles.maxY; ++ty)
+		{
+			for (int tx{ tiles.minX }; tx <= tiles.maxX; ++tx)
+			{
+				const int tile = ty * m_TileCountX + tx;
+				const Vector2& range = tileDepthRanges[tile];
 
-	m_pDepthBufferPixels = new float[m_Width * m_Height];
+				if (range.x <= tiles.maxDepth && range.y >= tiles.minDepth)
+				{
+					function(tile);
+				}
+			}
+		}
+	};
 
-	//Initialize Camera
-	auto aspectRatio = static_cast<float>(m_Width) / m_Height;
-	m_Camera.Initialize(aspectRatio, 45.f, { .0f, 0.0f, 0.0f });
+	// Count, prefix sum, fill
+	m_TileLightOffsets.assign(tileCount + 1, 0);
+	for (const LightTiles& tiles : lightTiles)
+	{
+		forEachTile(tiles, [this](int tile) { ++m_TileLightOffsets[tile + 1]; });
+	}
 
-	// Load textures
-	m_pTexture = Texture::LoadFromFile("Resources/vehicle_diffuse.png");
-	m_pNormal = Texture::LoadFromFile("Resources/vehicle_normal.png");
-	m_pGloss = Texture::LoadFromFile("Resources/vehicle_gloss.png");
-	m_pSpecular = Texture::LoadFromFile("Resources/vehicle_specular.png");
+	for (int i{}; i < tileCount; ++i)
+	{
+		m_TileLightOffsets[i + 1] += m_TileLightOffsets[i];
+	}
 
-	// Initialize mesh
-	Utils::ParseOBJ("Resources/vehicle.obj", m_Mesh.vertices, m_Mesh.indices);
-	m_Mesh.primitiveTopology = PrimitiveTopology::TriangleList;
-	m_Mesh.worldMatrix = Matrix::CreateTranslation(0.f, 0.f, 50.f);
+	m_TileLightIndices.resize(m_TileLightOffsets[tileCount]);
+	std::vector<uint32_t> cursors(m_TileLightOffsets.begin(), m_TileLightOffsets.end() - 1);
+	for (const LightTiles& tiles : lightTiles)
+	{
+		forEachTile(tiles, [&](int tile) { m_TileLightIndices[cursors[tile]++] = tiles.lightIndex; });
+	}
 }
 
-Renderer::~Renderer()
+std::span<const uint32_t> Renderer::GetTileLights(int px, int py) const
 {
-	delete[] m_pDepthBufferPixels;
-	delete m_pTexture;
-	delete m_pNormal;
-	delete m_pGloss;
-	delete m_pSpecular;
+	if (m_TileLightOffsets.empty())
+	{
+		return {};
+	}
+
+	const int tile = (py / TileSize) * m_TileCountX + px / TileSize;
+	return { m_TileLightIndices.data() + m_TileLightOffsets[tile], m_TileLightIndices.data() + m_TileLightOffsets[tile + 1] };
 }
 
-void Renderer::Update(Timer* pTimer)
+void Renderer::AdoptLoadedTextures()
 {
-	m_Camera.Update(pTimer);
-
-	if (m_RotateMesh)
+	for (size_t i{}; i < m_PendingTextures.size();)
 	{
-		m_MeshRotation += pTimer->GetElapsed();
+		PendingTexture& pending = m_PendingTextures[i];
+		if (pending.texture.wait_for(std::chrono::seconds{}) != std::future_status::ready)
+		{
+			++i;
+			continue;
+		}
+
+		// A failed load leaves the placeholder in its slot
+		Texture* pTexture = pending.texture.get();
+		if (pTexture)
+		{
+			m_Textures.push_back(pTexture);
+			m_Materials[pending.materialIndex].*pending.pSlot = pTexture;
+		}
 
-		m_Mesh.worldMatrix = Matrix::CreateRotationY(m_MeshRotation) * Matrix::CreateTranslation(0.f, 0.f, 50.f);
+		m_PendingTextures.erase(m_PendingTextures.begin() + i);
+
+		// Virtual textures only hold their pinned pages yet, the rest are added as they are sampled
+		if (m_PendingTextures.empty())
+		{
+			size_t memorySize{};
+			for (const Texture* pTexture : m_Textures)
+			{
+				memorySize += pTexture->GetMemorySize();
+			}
+			std::cout << "Textures loaded, " << memorySize / 1024 << " KB resident\n";
+		}
 	}
 }
 
-void Renderer::Render()
+void Renderer::UpdateViewRays()
 {
-	// Lock BackBuffer
-	SDL_LockSurface(m_pBackBuffer);
+	const float tanX = m_Camera.aspectRatio * m_Camera.fov;
+	const float tanY = m_Camera.fov;
 
-	// Clear BackBuffer
-	// convert rgb to decimal
-	auto decimalColor = (100 << 16) + (100 << 8) + 100;
-	SDL_FillRect(m_pBackBuffer, NULL, decimalColor);
+	m_ViewRays.origin = m_Camera.forward - m_Camera.right * tanX + m_Camera.up * tanY;
+	m_ViewRays.stepX = m_Camera.right * (2.f * tanX / m_Width);
+	m_ViewRays.stepY = m_Camera.up * (-2.f * tanY / m_Height);
 
-	// Initialize Depth buffer
-	std::fill_n(m_pDepthBufferPixels, m_Width * m_Height, std::numeric_limits<float>::max());
+	const Vector3Packet stepX = Vector3Packet::Broadcast(m_ViewRays.stepX);
+	const __m256 laneOffsets = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
 
-	std::vector<Mesh> meshes_world{ m_Mesh };
+	for (int py{}; py < m_Height; ++py)
+	{
+		const Vector3Packet rowStart = Vector3Packet::Broadcast(m_ViewRays.origin + m_ViewRays.stepY * float(py));
 
-	VertexTransformationFunction(meshes_world);
-	RenderMeshes(meshes_world);
+		for (int px{}; px < m_ViewDirectionStride; px += 8)
+		{
+			const Vector3Packet ray = (rowStart + stepX * _mm256_add_ps(_mm256_set1_ps(float(px)), laneOffsets)).Normalized();
 
-	//@END
-	//Update SDL Surface
-	SDL_UnlockSurface(m_pBackBuffer);
-	SDL_BlitSurface(m_pBackBuffer, 0, m_pFrontBuffer, 0);
-	SDL_UpdateWindowSurface(m_pWindow);
+			const int index = py * m_ViewDirectionStride + px;
+			_mm256_storeu_ps(&m_ViewDirectionsX[index], ray.x);
+			_mm256_storeu_ps(&m_ViewDirectionsY[index], ray.y);
+			_mm256_storeu_ps(&m_ViewDirectionsZ[index], ray.z);
+		}
+	}
+}
+
+Vector3Packet Renderer::GetViewDirections(int px, int py) const
+{
+	const int index = py * m_ViewDirectionStride + px;
+	return { _mm256_loadu_ps(&m_ViewDirectionsX[index]), _mm256_loadu_ps(&m_ViewDirectionsY[index]), _mm256_loadu_ps(&m_ViewDirectionsZ[index]) };
 }
 
-void Renderer::VertexTransformationFunction(std::vector<Mesh>& meshes) const
+void Renderer::UpdateShadowMap()
 {
-	for (auto& mesh : meshes)
+	m_ShadowLight = -1;
+
+	if (!m_UseShadows)
+	{
+		return;
+	}
+
+	const auto shadowLight = std::find_if(m_DirectionalLights.begin(), m_DirectionalLights.end(), [this](uint32_t i) { return m_Lights[i].castsShadows; });
+	if (shadowLight == m_DirectionalLights.end())
+	{
+		return;
+	}
+
+	const auto castsShadows = [this](const MeshInstance& instance)
+	{
+		return m_Materials[m_Meshes[instance.meshIndex].materialIndex].castsShadows;
+	};
+
+	// Without casters there is no volume to fit, the light stays unshadowed
+	if (std::none_of(m_MeshInstances.begin(), m_MeshInstances.end(), castsShadows))
+	{
+		return;
+	}
+
+	const Light& light = m_Lights[*shadowLight];
+	m_ShadowLight = int(*shadowLight);
+
+	// Only the light and the casters matter, camera movement keeps the cached map
+	const bool castersChanged = m_ShadowCasterMatrices.size() != m_MeshInstances.size() ||
+		!std::equal(m_ShadowCasterMatrices.begin(), m_ShadowCasterMatrices.end(), m_MeshInstances.begin(),
+			[](const Matrix& matrix, const MeshInstance& instance) { return std::memcmp(&matrix, &instance.worldMatrix, sizeof(Matrix)) == 0; });
+	const bool lightChanged = std::memcmp(&m_ShadowLightDirection, &light.direction, sizeof(Vector3)) != 0;
+
+	if (!castersChanged && !lightChanged)
+	{
+		return;
+	}
+
+	m_ShadowLightDirection = light.direction;
+	m_ShadowCasterMatrices.clear();
+	for (const MeshInstance& instance : m_MeshInstances)
+	{
+		m_ShadowCasterMatrices.push_back(instance.worldMatrix);
+	}
+
+	// Light space basis looking down the light direction
+	const Vector3 forward = light.direction.Normalized();
+	const Vector3 right = Vector3::Cross(std::abs(forward.y) > 0.99f ? Vector3::UnitX : Vector3::UnitY, forward).Normalized();
+	const Vector3 up = Vector3::Cross(forward, right);
+	// Orthonormal, so the inverse is the transpose
+	const Matrix lightView
+	{
+		{ right.x, up.x, forward.x, 0 },
+		{ right.y, up.y, forward.y, 0 },
+		{ right.z, up.z, forward.z, 0 },
+		{ 0, 0, 0, 1 }
+	};
+
+	// Fit the orthographic volume around every caster's bounding box
+	Vector3 minBounds{ FLT_MAX, FLT_MAX, FLT_MAX };
+	Vector3 maxBounds{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+	for (const MeshInstance& instance : m_MeshInstances)
 	{
-		Matrix matrix{ mesh.worldMatrix * m_Camera.viewMatrix * m_Camera.projectionMatrix };
-		mesh.vertices_out.clear();
-		mesh.vertices_out.reserve(mesh.vertices.size());
+		if (!castsShadows(instance))
+		{
+			continue;
+		}
+
+		const Mesh& mesh = m_Meshes[instance.meshIndex];
+		const Matrix toLight = instance.worldMatrix * lightView;
 
-		for (size_t i{}; i < mesh.vertices.size(); ++i)
+		for (int i{}; i < 8; ++i)
 		{
-			Vertex_Out v{};
+			const Vector3 corner = toLight.TransformPoint(Vector3{
+				i & 1 ? mesh.maxBounds.x : mesh.minBounds.x,
+				i & 2 ? mesh.maxBounds.y : mesh.minBounds.y,
+				i & 4 ? mesh.maxBounds.z : mesh.minBounds.z });
+
+			minBounds = { std::min(minBounds.x, corner.x), std::min(minBounds.y, corner.y), std::min(minBounds.z, corner.z) };
+			maxBounds = { std::max(maxBounds.x, corner.x), std::max(maxBounds.y, corner.y), std::max(maxBounds.z, corner.z) };
+		}
+	}
+
+	// Triangles touching the border of a target get culled whole, keep a margin
+	const Vector3 margin = (maxBounds - minBounds) * 0.02f + Vector3{ 1.f, 1.f, 1.f };
+	minBounds -= margin;
+	maxBounds += margin;
+	const Vector3 size = maxBounds - minBounds;
 
-			v.position = matrix.TransformPoint({ mesh.vertices[i].position, 1.f });
+	const Matrix projection
+	{
+		{ 2.f / size.x, 0, 0, 0 },
+		{ 0, 2.f / size.y, 0, 0 },
+		{ 0, 0, 1.f / size.z, 0 },
+		{ -(minBounds.x + maxBounds.x) / size.x, -(minBounds.y + maxBounds.y) / size.y, -minBounds.z / size.z, 1 }
+	};
+
+	m_ShadowViewProjection = lightView * projection;
+	// Half a world unit of depth against acne
+	m_ShadowBias = 0.5f / size.z;
+
+	// Depth only pass into the shadow map, always at full detail so camera driven LOD changes don't invalidate it
+	std::fill(m_ShadowMap.begin(), m_ShadowMap.end(), std::numeric_limits<float>::max());
+	m_RasterTarget = { m_ShadowMap.data(), ShadowMapSize, ShadowMapSize };
+
+	const RasterFunction rasterFunction = &Renderer::RenderTriangle<PipelineState{ LightingMode::ObservedArea, false, false, PowMode::Exact, true, false, true }>;
 
-			v.position.x /= v.position.w;
-			v.position.y /= v.position.w;
-			v.position.z /= v.position.w;
+	for (const MeshInstance& instance : m_MeshInstances)
+	{
+		if (!castsShadows(instance))
+		{
+			continue;
+		}
 
-			v.position.x = ((1.f + v.position.x) / 2.f) * m_Width;
-			v.position.y = ((1.f - v.position.y) / 2.f) * m_Height;
+		const Mesh& mesh = m_Meshes[instance.meshIndex];
+		if (mesh.IsPacked())
+		{
+			TransformPositions(mesh.GetPackedVertices(0), mesh.minBounds, mesh.maxBounds, instance.worldMatrix * m_ShadowViewProjection);
+		}
+		else
+		{
+			TransformPositions(mesh.GetVertices(0), instance.worldMatrix * m_ShadowViewProjection);
+		}
 
-			v.color = mesh.vertices[i].color;
-			v.uv = mesh.vertices[i].uv;
-			v.normal = mesh.worldMatrix.TransformVector(mesh.vertices[i].normal);
-			v.tangent = mesh.worldMatrix.TransformVector(mesh.vertices[i].tangent);
+		if (!CullTriangles(mesh, 0))
+		{
+			continue;
+		}
 
-			mesh.vertices_out.emplace_back(v);
+		for (size_t i{}; i < m_VisibleIndices.size(); i += 3)
+		{
+			(this->*rasterFunction)(m_VerticesOut[m_VisibleIndices[i]], m_VerticesOut[m_VisibleIndices[i + 1]], m_VerticesOut[m_VisibleIndices[i + 2]]);
 		}
 	}
-}
 
-bool Renderer::SaveBufferToImage() const
-{
-	return SDL_SaveBMP(m_pBackBuffer, "Rasterizer_ColorBuffer.bmp");
+	m_RasterTarget = { m_pDepthBufferPixels, m_Width, m_Height };
 }
 
-void Renderer::ToggleDepthBufferVisualization()
+__m256 Renderer::SampleShadow(const Vector3Packet& position, __m256 mask) const
 {
-	m_DepthBufferVisualization = !m_DepthBufferVisualization;
-	std::cout << "Toggled Depth Visualization To: " << m_DepthBufferVisualization << "\n";
-}
+	const MatrixBatch shadowViewProjection{ m_ShadowViewProjection };
+	const __m256 one = _mm256_set1_ps(1.f);
+	const __m256 halfSize = _mm256_set1_ps(ShadowMapSize / 2.f);
 
-void Renderer::ToggleMeshRotation()
-{
-	m_RotateMesh = !m_RotateMesh;
-	std::cout << "Toggled Mesh Rotation To: " << m_RotateMesh << "\n";
-}
+	// Orthographic, w stays 1
+	const __m256 x = _mm256_mul_ps(_mm256_add_ps(one, shadowViewProjection.TransformPoint(0, position.x, position.y, position.z)), halfSize);
+	const __m256 y = _mm256_mul_ps(_mm256_sub_ps(one, shadowViewProjection.TransformPoint(1, position.x, position.y, position.z)), halfSize);
+	const __m256 receiverDepth = _mm256_sub_ps(shadowViewProjection.TransformPoint(2, position.x, position.y, position.z), _mm256_set1_ps(m_ShadowBias));
 
-void Renderer::ToggleNormalMap()
-{
-	m_UseNormalMap = !m_UseNormalMap;
-	std::cout << "Toggled Normal Map To: " << m_UseNormalMap << "\n";
-}
+	const __m256i centerX = _mm256_cvtps_epi32(x);
+	const __m256i centerY = _mm256_cvtps_epi32(y);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i maxIndex = _mm256_set1_epi32(ShadowMapSize - 1);
 
-void Renderer::CycleLightingMode()
-{
-	m_LightingMode = LightingMode(((int)m_LightingMode + 1) % (int)LightingMode::End);
+	__m256 lit{};
 
-	std::cout << "Toggled Lighting Mode To: " << (int)m_LightingMode << "\n";
-}
+	for (int dy{ -1 }; dy <= 1; ++dy)
+	{
+		const __m256i tapY = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(centerY, _mm256_set1_epi32(dy)), zero), maxIndex);
 
-// Private functions
+		for (int dx{ -1 }; dx <= 1; ++dx)
+		{
+			const __m256i tapX = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(centerX, _mm256_set1_epi32(dx)), zero), maxIndex);
+			const __m256i index = _mm256_add_epi32(tapX, _mm256_mullo_epi32(tapY, _mm256_set1_epi32(ShadowMapSize)));
 
-void Renderer::RenderTriangle(const Vertex_Out& v0, const Vertex_Out& v1, const Vertex_Out& v2) const
+			const __m256 occluderDepth = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), m_ShadowMap.data(), index, mask, sizeof(float));
+			lit = _mm256_add_ps(lit, _mm256_and_ps(_mm256_cmp_ps(receiverDepth, occluderDepth, _CMP_LE_OQ), one));
+		}
+	}
+
+	return _mm256_mul_ps(lit, _mm256_set1_ps(1.f / 9.f));
+}
+
+bool Renderer::IsTriangleVisible(const Vertex_Out& v0, const Vertex_Out& v1, const Vertex_Out& v2) const
 {
 	// Frustum culling x & y
+	const float width = float(m_RasterTarget.width);
+	const float height = float(m_RasterTarget.height);
+
 	if (v0.position.x < 0 || v1.position.x < 0 || v2.position.x < 0 ||
-		v0.position.x > m_Width || v1.position.x > m_Width || v2.position.x > m_Width ||
+		v0.position.x > width || v1.position.x > width || v2.position.x > width ||
 		v0.position.y < 0 || v1.position.y < 0 || v2.position.y < 0 ||
-		v0.position.y > m_Height || v1.position.y > m_Height || v2.position.y > m_Height)
+		v0.position.y > height || v1.position.y > height || v2.position.y > height)
 	{
-		return;
+		return false;
 	}
 
+	// Back facing and sub pixel triangles
+	const Vector2 edge0 = { v2.position.GetXY() - v1.position.GetXY() };
+	const Vector2 edge1 = { v0.position.GetXY() - v2.position.GetXY() };
+
+	return Vector2::Cross(edge0, edge1) >= 1.0f;
+}
+
+template<Renderer::PipelineState State>
+void Renderer::RenderTriangle(const Vertex_Out& v0, const Vertex_Out& v1, const Vertex_Out& v2) const
+{
 	Vector2 edge0 = { v2.position.GetXY() - v1.position.GetXY() };
 	Vector2 edge1 = { v0.position.GetXY() - v2.position.GetXY() };
 	Vector2 edge2 = { v1.position.GetXY() - v0.position.GetXY() };
 
 	float area = Vector2::Cross(edge0, edge1);
 
-	if (area < 1.0f)
-	{
-		return;
-	}
-
 	auto top = std::max(std::max(v0.position.y, v1.position.y), v2.position.y);
 	auto bottom = std::min(std::min(v0.position.y, v1.position.y), v2.position.y);
 	auto left = std::min(std::min(v0.position.x, v1.position.x), v2.position.x);
 	auto right = std::max(std::max(v0.position.x, v1.position.x), v2.position.x);
 
-	for (int px{ static_cast<int>(left) }; px < static_cast<int>(right); ++px)
+	const int startX = static_cast<int>(left);
+	const int endX = static_cast<int>(right);
+	// Packets stay 8 aligned so each one falls inside a single light tile
+	const int alignedStartX = startX & ~7;
+
+	const __m256 laneOffsets = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+	const __m256i laneIndices = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.f);
+	const __m256 areaPacket = _mm256_set1_ps(area);
+
+	// The perspective weights w_i / v_i.w are linear in screen space, so are their sums with the UVs.
+	// Per pixel the UV derivatives then only need the quotient rule: (a - uv * b) * depth
+	Vector2 uvGradientX{};
+	Vector2 uvGradientY{};
+	float weightGradientX{};
+	float weightGradientY{};
+	if constexpr (State.UsesUV() && State.mipmaps)
 	{
-		for (int py{ static_cast<int>(bottom) }; py < static_cast<int>(top); ++py)
-		{
-			Vector2 pixel{ static_cast<float>(px), static_cast<float>(py) };
+		const float invArea = 1.f / area;
+		const float dw0dx = -edge0.y * invArea / v0.position.w;
+		const float dw1dx = -edge1.y * invArea / v1.position.w;
+		const float dw2dx = -edge2.y * invArea / v2.position.w;
+		const float dw0dy = edge0.x * invArea / v0.position.w;
+		const float dw1dy = edge1.x * invArea / v1.position.w;
+		const float dw2dy = edge2.x * invArea / v2.position.w;
+
+		uvGradientX = v0.uv * dw0dx + v1.uv * dw1dx + v2.uv * dw2dx;
+		uvGradientY = v0.uv * dw0dy + v1.uv * dw1dy + v2.uv * dw2dy;
+		weightGradientX = dw0dx + dw1dx + dw2dx;
+		weightGradientY = dw0dy + dw1dy + dw2dy;
+	}
 
-			Vector2 p0ToPixel = pixel - v0.position.GetXY();
-			auto w2 = Vector2::Cross(edge2, p0ToPixel) / area;
+	// Row by row, 8 pixels per step
+	for (int py{ static_cast<int>(bottom) }; py < static_cast<int>(top); ++py)
+	{
+		const __m256 pixelY = _mm256_set1_ps(static_cast<float>(py));
 
-			if (w2 < 0.0f)
+		for (int px{ alignedStartX }; px < endX; px += 8)
+		{
+			const __m256 pixelX = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(px)), laneOffsets);
+
+			// Lanes outside the bounding box never touch memory
+			__m256 mask = _mm256_castsi256_ps(_mm256_andnot_si256(
+				_mm256_cmpgt_epi32(_mm256_set1_epi32(startX - px), laneIndices),
+				_mm256_cmpgt_epi32(_mm256_set1_epi32(endX - px), laneIndices)));
+
+			__m256 w2 = _mm256_div_ps(_mm256_sub_ps(
+				_mm256_mul_ps(_mm256_set1_ps(edge2.x), _mm256_sub_ps(pixelY, _mm256_set1_ps(v0.position.y))),
+				_mm256_mul_ps(_mm256_set1_ps(edge2.y), _mm256_sub_ps(pixelX, _mm256_set1_ps(v0.position.x)))), areaPacket);
+			__m256 w0 = _mm256_div_ps(_mm256_sub_ps(
+				_mm256_mul_ps(_mm256_set1_ps(edge0.x), _mm256_sub_ps(pixelY, _mm256_set1_ps(v1.position.y))),
+				_mm256_mul_ps(_mm256_set1_ps(edge0.y), _mm256_sub_ps(pixelX, _mm256_set1_ps(v1.position.x)))), areaPacket);
+			__m256 w1 = _mm256_div_ps(_mm256_sub_ps(
+				_mm256_mul_ps(_mm256_set1_ps(edge1.x), _mm256_sub_ps(pixelY, _mm256_set1_ps(v2.position.y))),
+				_mm256_mul_ps(_mm256_set1_ps(edge1.y), _mm256_sub_ps(pixelX, _mm256_set1_ps(v2.position.x)))), areaPacket);
+
+			mask = _mm256_and_ps(mask, _mm256_cmp_ps(w2, zero, _CMP_NLT_UQ));
+			mask = _mm256_and_ps(mask, _mm256_cmp_ps(w0, zero, _CMP_NLT_UQ));
+			mask = _mm256_and_ps(mask, _mm256_cmp_ps(w1, zero, _CMP_NLT_UQ));
+
+			if (_mm256_movemask_ps(mask) == 0)
 			{
 				continue;
 			}
 
-			Vector2 p1ToPixel = pixel - v1.position.GetXY();
-			auto w0 = Vector2::Cross(edge0, p1ToPixel) / area;
+			// Deoth Buffer
+			float* pDepth = m_RasterTarget.pDepth + px + py * m_RasterTarget.width;
+			const __m256 storedDepth = _mm256_maskload_ps(pDepth, _mm256_castps_si256(mask));
 
-			if (w0 < 0.0f)
+			__m256 depthBuffer{};
+			if constexpr (State.orthographic)
 			{
-				continue;
+				depthBuffer = _mm256_fmadd_ps(w0, _mm256_set1_ps(v0.position.z), _mm256_fmadd_ps(w1, _mm256_set1_ps(v1.position.z), _mm256_mul_ps(w2, _mm256_set1_ps(v2.position.z))));
+			}
+			else
+			{
+				depthBuffer = _mm256_div_ps(one, _mm256_add_ps(_mm256_add_ps(
+					_mm256_div_ps(w0, _mm256_set1_ps(v0.position.z)),
+					_mm256_div_ps(w1, _mm256_set1_ps(v1.position.z))),
+					_mm256_div_ps(w2, _mm256_set1_ps(v2.position.z))));
 			}
 
-			Vector2 p2ToPixel = pixel - v2.position.GetXY();
-			auto w1 = Vector2::Cross(edge1, p2ToPixel) / area;
-
-			if (w1 < 0.0f)
+			// frustum culling z + depth test
+			const __m256 rejected = _mm256_or_ps(_mm256_or_ps(
+				_mm256_cmp_ps(depthBuffer, zero, _CMP_LT_OQ),
+				_mm256_cmp_ps(depthBuffer, one, _CMP_GT_OQ)),
+				_mm256_cmp_ps(depthBuffer, storedDepth, _CMP_GT_OQ));
+			mask = _mm256_andnot_ps(rejected, mask);
+
+			const int coverage = _mm256_movemask_ps(mask);
+			if (coverage == 0)
 			{
 				continue;
 			}
 
-			// Deoth Buffer
-			float depthBuffer = 1.f / (w0 / v0.position.z + w1 / v1.position.z + w2 / v2.position.z);
+			_mm256_maskstore_ps(pDepth, _mm256_castps_si256(mask), depthBuffer);
 
-			// frustum culling z + depth test
-			if (depthBuffer < 0 || depthBuffer > 1 ||
-				depthBuffer > m_pDepthBufferPixels[px + py * m_Width])
+			if constexpr (State.depthOnly)
 			{
 				continue;
 			}
 
-			m_pDepthBufferPixels[px + py * m_Width] = depthBuffer;
-
 			// actual depth
-			w0 /= v0.position.w;
-			w1 /= v1.position.w;
-			w2 /= v2.position.w;
+			w0 = _mm256_div_ps(w0, _mm256_set1_ps(v0.position.w));
+			w1 = _mm256_div_ps(w1, _mm256_set1_ps(v1.position.w));
+			w2 = _mm256_div_ps(w2, _mm256_set1_ps(v2.position.w));
 
-			auto depth = 1.0f / (w0 + w1 + w2);
+			const __m256 depth = _mm256_div_ps(one, _mm256_add_ps(_mm256_add_ps(w0, w1), w2));
 
-			ColorRGB finalColor{};
+			ColorRGBPacket finalColor{};
 
-			if (m_DepthBufferVisualization)
+			if constexpr (State.depthVisualization)
 			{
 				// Remap so it isnt too bright 
-				depthBuffer = (depthBuffer - 0.985f) / (1.0f - 0.985f);
+				depthBuffer = _mm256_div_ps(_mm256_sub_ps(depthBuffer, _mm256_set1_ps(0.985f)), _mm256_set1_ps(1.0f - 0.985f));
 
-				depthBuffer = Clamp(depthBuffer, 0.f, 1.f);
+				depthBuffer = Saturate(depthBuffer);
 				finalColor = { depthBuffer, depthBuffer, depthBuffer };
 			}
 			else
 			{
-				Vertex_Out shadingVertex{};
-				shadingVertex.position.x = (float)px;
-				shadingVertex.position.y = (float)py;
-				shadingVertex.color = (w0 * v0.color + w1 * v1.color + w2 * v2.color) * depth;
-				shadingVertex.uv = (w0 * v0.uv + w1 * v1.uv + w2 * v2.uv) * depth;
-				shadingVertex.normal = ((w0 * v0.normal + w1 * v1.normal + w2 * v2.normal) * depth).Normalized();
-				shadingVertex.tangent = ((w0 * v0.tangent + w1 * v1.tangent + w2 * v2.tangent) * depth).Normalized();
-
-				finalColor = PixelShading(shadingVertex);
-			}
+				// Only interpolate what this pipeline's shading reads
+				FragmentPacket fragment{};
+				fragment.mask = mask;
+				fragment.position = { pixelX, pixelY };
+				fragment.depth = depth;
+				fragment.normal = Interpolate(w0, w1, w2, depth, v0.normal, v1.normal, v2.normal).Normalized();
+
+				if constexpr (State.UsesSpecular())
+				{
+					fragment.viewDirection = GetViewDirections(px, py);
+				}
+
+				if constexpr (State.UsesUV())
+				{
+					fragment.uv = Interpolate(w0, w1, w2, depth, v0.uv, v1.uv, v2.uv);
+
+					if constexpr (State.mipmaps)
+					{
+						const auto derivative = [&](float gradient, float weightGradient, __m256 uv)
+						{
+							return _mm256_mul_ps(_mm256_fnmadd_ps(uv, _mm256_set1_ps(weightGradient), _mm256_set1_ps(gradient)), depth);
+						};
+						fragment.uvDdx = { derivative(uvGradientX.x, weightGradientX, fragment.uv.x), derivative(uvGradientX.y, weightGradientX, fragment.uv.y) };
+						fragment.uvDdy = { derivative(uvGradientY.x, weightGradientY, fragment.uv.x), derivative(uvGradientY.y, weightGradientY, fragment.uv.y) };
+					}
+				}
+				if constexpr (State.useNormalMap)
+				{
+					fragment.tangent = Interpolate(w0, w1, w2, depth, v0.tangent, v1.tangent, v2.tangent).Normalized();
+				}
 
-			finalColor.MaxToOne();
+				finalColor = PixelShading<State>(fragment, GetTileLights(px, py));
+			}
 
-			m_pBackBufferPixels[px + (py * m_Width)] = SDL_MapRGB(m_pBackBuffer->format,
-				static_cast<uint8_t>(finalColor.r * 255),
-				static_cast<uint8_t>(finalColor.g * 255),
-				static_cast<uint8_t>(finalColor.b * 255));
+			if constexpr (State.hdr && !State.depthVisualization)
+			{
+				m_pHdrBuffer->WritePacket(px, py, finalColor, mask);
+			}
+			else
+			{
+				m_pBackBuffer->WritePacket(px, py, finalColor, mask);
+			}
 		}
 	}
 }
 
-void Renderer::RenderMeshes(const std::vector<Mesh>& meshes) const
+bool Renderer::IsInsideFrustum(const Mesh& mesh, const Matrix& worldViewProjectionMatrix) const
+{
+	// Culled when all 8 bounding box corners are outside the same clip plane
+	int outside[6]{};
+
+	for (int i{}; i < 8; ++i)
+	{
+		const Vector4 corner = worldViewProjectionMatrix.TransformPoint(
+			i & 1 ? mesh.maxBounds.x : mesh.minBounds.x,
+			i & 2 ? mesh.maxBounds.y : mesh.minBounds.y,
+			i & 4 ? mesh.maxBounds.z : mesh.minBounds.z,
+			1.f);
+
+		outside[0] += corner.x < -corner.w;
+		outside[1] += corner.x > corner.w;
+		outside[2] += corner.y < -corner.w;
+		outside[3] += corner.y > corner.w;
+		outside[4] += corner.z < 0.f;
+		outside[5] += corner.z > corner.w;
+	}
+
+	return std::none_of(std::begin(outside), std::end(outside), [](int count) { return count == 8; });
+}
+
+void Renderer::SelectLOD(const Mesh& mesh, MeshInstance& instance) const
+{
+	if (!m_UseLOD || mesh.lods.empty())
+	{
+		instance.lodIndex = 0;
+		return;
+	}
+
+	const Matrix& worldMatrix = instance.worldMatrix;
+	const Vector3 center = worldMatrix.TransformPoint((mesh.minBounds + mesh.maxBounds) / 2.f);
+	const float scale = std::max(std::max(worldMatrix.GetAxisX().Magnitude(), worldMatrix.GetAxisY().Magnitude()), worldMatrix.GetAxisZ().Magnitude());
+	const float radius = (mesh.maxBounds - mesh.minBounds).Magnitude() / 2.f * scale;
+	const float distance = std::max((center - m_Camera.origin).Magnitude() - radius, m_Camera.near);
+
+	// Object space error to pixels at the closest point of the bounding sphere
+	const float errorToPixels = scale * m_Height / (2.f * distance * m_Camera.fov);
+
+	// Refine as soon as the current level is visibly off, only coarsen once the next level is well below the threshold
+	uint32_t lodIndex = std::min(instance.lodIndex, uint32_t(mesh.lods.size()));
+	while (lodIndex > 0 && mesh.lods[lodIndex - 1].error * errorToPixels > m_LODPixelError)
+	{
+		--lodIndex;
+	}
+	while (lodIndex < mesh.lods.size() && mesh.lods[lodIndex].error * errorToPixels < m_LODPixelError * m_LODHysteresis)
+	{
+		++lodIndex;
+	}
+
+	instance.lodIndex = lodIndex;
+}
+
+template<Renderer::PipelineState State>
+ColorRGBPacket Renderer::PixelShading(const FragmentPacket& fragment, std::span<const uint32_t> tileLights) const
 {
-	for (size_t i = 0; i < meshes.size(); i++)
+	Vector3Packet normal{ fragment.normal };
+	const Vector3Packet& viewDirection{ fragment.viewDirection };
+
+	// Without mipmaps the derivatives stay zero and every read comes from the full image
+	const SamplerState sampler{ m_TextureFilter, m_pMaterial->address };
+	const auto sample = [&fragment, &sampler](const Texture* pTexture)
 	{
-		auto mesh = meshes[i];
+		return pTexture->SampleGrad(fragment.uv, fragment.uvDdx, fragment.uvDdy, sampler, fragment.mask);
+	};
+
+	constexpr bool usesAlbedo = State.lightingMode == LightingMode::Diffuse || State.lightingMode == LightingMode::Combined;
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.f);
+
+	// Material inputs are sampled once and shared by every light
+	ColorRGBPacket albedo{};
+	ColorRGBPacket specular{};
+	__m256 gloss{};
+	Vector3Packet tangentNormal{};
 
-		if (mesh.primitiveTopology == PrimitiveTopology::TriangleList)
+	if constexpr (State.packedMaterial)
+	{
+		if constexpr (State.useNormalMap || usesAlbedo || State.UsesSpecular())
 		{
-			for (size_t i = 0; i < mesh.indices.size() - 2; i += 3)
-			{
-				RenderTriangle(mesh.vertices_out[mesh.indices[i]], mesh.vertices_out[mesh.indices[i + 1]], mesh.vertices_out[mesh.indices[i + 2]]);
-			}
+			// Every map in one fetch, gloss comes premultiplied by the shine
+			const MaterialPacket material = m_pMaterial->pPacked->SampleMaterial(fragment.uv, fragment.uvDdx, fragment.uvDdy, sampler, State.hdr, fragment.mask);
+			albedo = material.diffuse;
+			tangentNormal = material.normal;
+			specular = { material.specular, material.specular, material.specular };
+			gloss = material.gloss;
+		}
+	}
+	else
+	{
+		if constexpr (State.useNormalMap)
+		{
+			// sample and remap color to [-1, 1]
+			const ColorRGBPacket sampledColor = sample(m_pMaterial->pNormal);
+			const __m256 two = _mm256_set1_ps(2.f);
+			tangentNormal = {
+				_mm256_sub_ps(_mm256_mul_ps(two, sampledColor.r), one),
+				_mm256_sub_ps(_mm256_mul_ps(two, sampledColor.g), one),
+				_mm256_sub_ps(_mm256_mul_ps(two, sampledColor.b), one) };
 		}
-		else if (meshes[i].primitiveTopology == PrimitiveTopology::TriangleStrip)
+		if constexpr (usesAlbedo)
 		{
-			for (size_t i = 0; i < mesh.indices.size() - 2; ++i)
+			// The diffuse maps are authored in sRGB, the HDR path does its lighting in linear space
+			if constexpr (State.hdr)
 			{
-				// try optimize without if statement, either 2 for loops or just adding/substracting the result of the modulo directly
-				if (i % 2)
-				{
-					RenderTriangle(mesh.vertices_out[mesh.indices[i]], mesh.vertices_out[mesh.indices[i + 2]], mesh.vertices_out[mesh.indices[i + 1]]);
-				}
-				else
-				{
-					RenderTriangle(mesh.vertices_out[mesh.indices[i]], mesh.vertices_out[mesh.indices[i + 1]], mesh.vertices_out[mesh.indices[i + 2]]);
-				}
+				albedo = m_pMaterial->pDiffuse->SampleGradLinear(fragment.uv, fragment.uvDdx, fragment.uvDdy, sampler, fragment.mask);
+			}
+			else
+			{
+				albedo = sample(m_pMaterial->pDiffuse);
 			}
 		}
+		if constexpr (State.UsesSpecular())
+		{
+			specular = sample(m_pMaterial->pSpecular);
+			gloss = _mm256_mul_ps(_mm256_set1_ps(m_pMaterial->shine), sample(m_pMaterial->pGloss).r);
+		}
 	}
-}
-
-ColorRGB Renderer::PixelShading(const Vertex_Out& v) const
-{
-	Vector3 lightDirection = { .577f, -.577f, .577f };
-	Vector3 normal{ v.normal };
 
-	// Create viewDirection
-	float x = (2 * (v.position.x + 0.5f / float(m_Width)) - 1) * m_Camera.aspectRatio * m_Camera.fov;
-	float y = (1 - (2 * (v.position.y + 0.5f / float(m_Height)))) * m_Camera.fov;
+	if constexpr (State.useNormalMap)
+	{
+		// Tangent space basis
+		const Vector3Packet binormal = Vector3Packet::Cross(fragment.normal, fragment.tangent);
+		normal = fragment.tangent * tangentNormal.x + binormal * tangentNormal.y + fragment.normal * tangentNormal.z;
+	}
 
-	Vector3 viewDirection = (x * m_Camera.right + y * m_Camera.up + m_Camera.forward).Normalized();
+	__m256 observedArea{};
+	ColorRGBPacket irradiance{};
+	ColorRGBPacket specularLight{};
+	// Lanes facing away from every light stay black
+	__m256 lit{};
 
-	if (m_UseNormalMap)
+	const auto addLight = [&](const Light& light, const Vector3Packet& toLight, __m256 attenuation)
 	{
-		// Create tangent space transformation matrix
-		Vector3 binormal = Vector3::Cross(v.normal, v.tangent);
-		Matrix tangentSpaceAxis{ v.tangent, binormal, v.normal, Vector3::Zero };
+		const __m256 dot = Vector3Packet::Dot(normal, toLight);
+		const __m256 lightLit = _mm256_and_ps(fragment.mask, _mm256_cmp_ps(dot, zero, _CMP_NLT_UQ));
+		if (_mm256_movemask_ps(lightLit) == 0)
+		{
+			return;
+		}
+
+		lit = _mm256_or_ps(lit, lightLit);
+		const __m256 litDot = _mm256_and_ps(_mm256_mul_ps(dot, attenuation), lightLit);
+
+		if constexpr (State.lightingMode == LightingMode::ObservedArea)
+		{
+			observedArea = _mm256_add_ps(observedArea, litDot);
+		}
+		if constexpr (usesAlbedo)
+		{
+			irradiance = irradiance + ColorRGBPacket::Broadcast(light.color) * _mm256_mul_ps(litDot, _mm256_set1_ps(light.intensity));
+		}
+		if constexpr (State.UsesSpecular())
+		{
+			specularLight = specularLight + Phong<State>(specular, gloss, toLight, viewDirection, normal, lightLit) * ColorRGBPacket::Broadcast(light.color) * _mm256_mul_ps(litDot, _mm256_set1_ps(light.specularIntensity));
+		}
+	};
 
-		// sample and remap color to [-1, 1]
-		ColorRGB sampledColor = m_pNormal->Sample(v.uv);
-		sampledColor = (2.f * sampledColor) - ColorRGB{ 1.f, 1.f, 1.f };
+	// World position from the camera ray through the pixel and its view space depth
+	Vector3Packet position{};
+	if (!tileLights.empty() || m_ShadowLight >= 0)
+	{
+		const Vector3Packet ray = Vector3Packet::Broadcast(m_ViewRays.origin) + Vector3Packet::Broadcast(m_ViewRays.stepX) * fragment.position.x + Vector3Packet::Broadcast(m_ViewRays.stepY) * fragment.position.y;
+		position = Vector3Packet::Broadcast(m_Camera.origin) + ray * fragment.depth;
+	}
 
-		normal = tangentSpaceAxis.TransformVector(sampledColor.r, sampledColor.g, sampledColor.b);
+	for (uint32_t lightIndex : m_DirectionalLights)
+	{
+		const Light& light = m_Lights[lightIndex];
+		addLight(light, Vector3Packet::Broadcast(-light.direction), int(lightIndex) == m_ShadowLight ? SampleShadow(position, fragment.mask) : one);
 	}
 
-	float dot = normal * -lightDirection;
+	for (uint32_t lightIndex : tileLights)
+	{
+		const Light& light = m_Lights[lightIndex];
+
+		const Vector3Packet toLight = Vector3Packet::Broadcast(light.position) - position;
+		const __m256 distanceSquared = Vector3Packet::Dot(toLight, toLight);
+
+		// Inverse square falloff, windowed to reach zero at the light's range
+		const __m256 ratio = _mm256_div_ps(distanceSquared, _mm256_set1_ps(light.range * light.range));
+		const __m256 window = Saturate(_mm256_sub_ps(one, _mm256_mul_ps(ratio, ratio)));
+		__m256 attenuation = _mm256_div_ps(_mm256_mul_ps(window, window), _mm256_max_ps(distanceSquared, _mm256_set1_ps(0.01f)));
+
+		const Vector3Packet direction = toLight * _mm256_div_ps(one, _mm256_sqrt_ps(distanceSquared));
+
+		if (light.type == LightType::Spot)
+		{
+			const __m256 cosAngle = _mm256_sub_ps(zero, Vector3Packet::Dot(direction, Vector3Packet::Broadcast(light.direction)));
+			const __m256 cone = Saturate(_mm256_div_ps(_mm256_sub_ps(cosAngle, _mm256_set1_ps(light.outerConeCos)), _mm256_set1_ps(light.innerConeCos - light.outerConeCos)));
+			attenuation = _mm256_mul_ps(attenuation, _mm256_mul_ps(cone, cone));
+		}
+
+		if (_mm256_movemask_ps(_mm256_and_ps(fragment.mask, _mm256_cmp_ps(attenuation, zero, _CMP_GT_OQ))) == 0)
+		{
+			continue;
+		}
+
+		addLight(light, direction, attenuation);
+	}
 
-	if (dot < 0.f)
+	if (_mm256_movemask_ps(lit) == 0)
 	{
 		return {};
 	}
 
-	ColorRGB finalColor{};
-	auto lightIntensity = 7.0f;
-	auto shine = 25.0f;
+	ColorRGBPacket finalColor{};
+	const __m256 diffuseScale = _mm256_set1_ps(m_pMaterial->lightIntensity / float(M_PI));
 
-	float dot2 = -1;
-
-	switch (m_LightingMode)
+	if constexpr (State.lightingMode == LightingMode::ObservedArea)
+	{
+		finalColor = { observedArea, observedArea, observedArea };
+	}
+	else if constexpr (State.lightingMode == LightingMode::Diffuse)
+	{
+		finalColor = albedo * irradiance * diffuseScale;
+	}
+	else if constexpr (State.lightingMode == LightingMode::Specular)
+	{
+		finalColor = specularLight;
+	}
+	else
 	{
-		case Renderer::LightingMode::ObservedArea:
-			finalColor = { dot, dot, dot };
-			break;
-		case Renderer::LightingMode::Diffuse:
-			finalColor = m_pTexture->Sample(v.uv) * dot * lightIntensity / M_PI;
-			break;
-		case Renderer::LightingMode::Specular:
-			finalColor = Phong(m_pSpecular->Sample(v.uv), shine * m_pGloss->Sample(v.uv).r, -lightDirection, viewDirection, normal) * dot;
-			break;
-		case Renderer::LightingMode::Combined:
-		default:
-			finalColor = m_pTexture->Sample(v.uv) * dot * lightIntensity / M_PI;
-			finalColor += Phong(m_pSpecular->Sample(v.uv), shine * m_pGloss->Sample(v.uv).r, -lightDirection, viewDirection, normal) * dot;
-			break;
+		finalColor = albedo * irradiance * diffuseScale + specularLight;
 	}
 
-	finalColor.MaxToOne();
-	return finalColor;
+	return finalColor.Masked(lit);
 }
 
-ColorRGB Renderer::Phong(ColorRGB specular, float gloss, Vector3 lightDir, Vector3 viewDir, Vector3 normal) const
+template<Renderer::PipelineState State>
+ColorRGBPacket Renderer::Phong(const ColorRGBPacket& specular, __m256 gloss, const Vector3Packet& lightDir, const Vector3Packet& viewDir, const Vector3Packet& normal, __m256 mask) const
 {
-	auto dot = (lightDir - (normal * (2.f * (normal * lightDir)))) * viewDir;
+	const __m256 two = _mm256_set1_ps(2.f);
+	const Vector3Packet reflected = lightDir - normal * _mm256_mul_ps(two, Vector3Packet::Dot(normal, lightDir));
+	const __m256 dot = Vector3Packet::Dot(reflected, viewDir);
 
-	if (dot < 0.f)
+	const __m256 visible = _mm256_and_ps(mask, _mm256_cmp_ps(dot, _mm256_setzero_ps(), _CMP_NLT_UQ));
+	if (_mm256_movemask_ps(visible) == 0)
 	{
 		return {};
 	}
 
-	return specular * powf(dot, gloss);
+	__m256 power{};
+	if constexpr (State.powMode == PowMode::Exact)
+	{
+		// No vector pow in AVX, only the lanes that reach it pay for powf
+		power = FastPow::Exact(dot, gloss, visible);
+	}
+	else if constexpr (State.powMode == PowMode::Polynomial)
+	{
+		power = _mm256_and_ps(FastPow::Polynomial(dot, gloss), visible);
+	}
+	else
+	{
+		power = _mm256_and_ps(m_PowTable.Sample(dot, gloss), visible);
+	}
+
+	return specular * power;
 }
@@ -1,18 +1,30 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
+#include <future>
+#include <span>
+#include <utility>
 #include <vector>
 
 #include "Camera.h"
 #include "DataTypes.h"
+#include "FastPow.h"
+#include "HdrBuffer.h"
+#include "Light.h"
+#include "Material.h"
+#include "ThreadPool.h"
 
 struct SDL_Window;
 struct SDL_Surface;
 
 namespace dae
 {
+	class FrameBuffer;
 	class Texture;
 	struct Mesh;
+	struct MeshInstance;
+	struct PackedVertexView;
 	struct Vertex;
 	struct Vertex_Out;
 	class Timer;
@@ -37,13 +49,29 @@ namespace dae
 		void ToggleMeshRotation();
 		void ToggleNormalMap();
 		void CycleLightingMode();
+		void ToggleLOD();
+		void ToggleTraffic();
+		void CycleSpecularPower();
+		void ToggleNightLights();
+		void ToggleShadows();
+		void ToggleHdr();
+		void CycleToneMapper();
+		void ToggleMipmaps();
+		void CycleTextureFilter();
+		void TogglePackedMaterials();
+
+		// Offline checks that take too long for a key press, run once from the command line
+		void PrintBenchmarks() const;
+
+		// A depth only pass skips the vertex attributes and shading, it only fills the depth buffer
+		void RenderInstanced(const Mesh& mesh, std::span<MeshInstance> instances, bool depthOnly = false);
 
 	private:
 		SDL_Window* m_pWindow{};
 
 		SDL_Surface* m_pFrontBuffer{ nullptr };
-		SDL_Surface* m_pBackBuffer{ nullptr };
-		uint32_t* m_pBackBufferPixels{};
+		FrameBuffer* m_pBackBuffer{ nullptr };
+		HdrBuffer* m_pHdrBuffer{ nullptr };
 
 		float* m_pDepthBufferPixels{};
 
@@ -53,11 +81,36 @@ namespace dae
 		int m_Width{};
 		int m_Height{};
 
-		Mesh m_Mesh{};
-		Texture* m_pTexture = nullptr;
-		Texture* m_pNormal = nullptr;
-		Texture* m_pGloss = nullptr;
-		Texture* m_pSpecular = nullptr;
+		std::vector<Mesh> m_Meshes{};
+		// Kept sorted by material, then mesh, so each run of equal meshes is one draw
+		std::vector<MeshInstance> m_MeshInstances{};
+		std::vector<Vertex_Out> m_VerticesOut{};
+		std::vector<uint32_t> m_VisibleIndices{};
+		std::vector<uint8_t> m_VertexVisibility{};
+
+		std::vector<Texture*> m_Textures{};
+		// Resident 128x128 pages of each virtual texture, 8 KB each for BC1 and BC4 and 16 KB for BC5.
+		// Holds all of the vehicle maps, lower budgets render with coarser levels where pages are missing
+		static constexpr int TexturePageBudget{ 96 };
+		// The same for the packed materials, 128 KB per page. The working set of the vehicle seen whole, 88 of
+		// its 92 pages
+		static constexpr int MaterialPageBudget{ 88 };
+		std::vector<Material> m_Materials{};
+
+		// Loads assets off the main thread
+		ThreadPool m_ThreadPool{};
+		// Textures still loading and the material slot each one fills once it arrives
+		struct PendingTexture
+		{
+			std::shared_future<Texture*> texture;
+			uint32_t materialIndex;
+			const Texture* Material::* pSlot;
+		};
+		std::vector<PendingTexture> m_PendingTextures{};
+		// Flat diffuse, normal, gloss and specular the materials sample until then
+		std::array<Texture*, 4> m_PlaceholderTextures{};
+		// Material of the draw being rasterized
+		const Material* m_pMaterial{ nullptr };
 
 		enum class LightingMode
 		{
@@ -68,17 +121,156 @@ namespace dae
 			End
 		};
 
+		// Compile time shading configuration, each combination gets its own raster loop
+		struct PipelineState
+		{
+			LightingMode lightingMode;
+			bool useNormalMap;
+			bool depthVisualization;
+			PowMode powMode;
+			bool depthOnly{ false };
+			// Unclipped linear color into the HDR buffer, tonemapped once the frame is done
+			bool hdr{ false };
+			// Depth is affine in screen space under an orthographic projection, interpolated as is
+			bool orthographic{ false };
+			// Every map from the material's packed texture in one fetch, picked only when it has one
+			bool packedMaterial{ false };
+			// UV derivatives for the mip level, without them every read comes from the full image
+			bool mipmaps{ false };
+
+			constexpr bool UsesSpecular() const
+			{
+				return lightingMode == LightingMode::Specular || lightingMode == LightingMode::Combined;
+			}
+
+			constexpr bool UsesUV() const
+			{
+				return useNormalMap || lightingMode != LightingMode::ObservedArea;
+			}
+		};
+
+		using RasterFunction = void (Renderer::*)(const Vertex_Out&, const Vertex_Out&, const Vertex_Out&) const;
+
+		static constexpr int RasterFunctionCount{ int(LightingMode::End) * 2 * int(PowMode::End) * 2 * 2 * 2 };
+
+		static constexpr PipelineState GetPipelineState(int index)
+		{
+			const bool mipmaps = index % 2;
+			index /= 2;
+			const bool packedMaterial = index % 2;
+			index /= 2;
+			const bool hdr = index % 2;
+			index /= 2;
+			return { LightingMode(index / (2 * int(PowMode::End))), bool(index / int(PowMode::End) % 2), false, PowMode(index % int(PowMode::End)), false, hdr, false, packedMaterial, mipmaps };
+		}
+
 		LightingMode m_LightingMode{ LightingMode::Combined };
 		bool m_DepthBufferVisualization = false;
 		bool m_RotateMesh = false;
 		bool m_UseNormalMap = true;
+		bool m_UseLOD = true;
+		bool m_ShowTraffic = false;
+		bool m_NightLights = false;
+		bool m_UseShadows = true;
+		bool m_UseHdr = false;
+		bool m_UseMipmaps = true;
+		bool m_UsePackedMaterials = true;
+		TextureFilter m_TextureFilter{ TextureFilter::Trilinear };
+		PowMode m_PowMode{ PowMode::Polynomial };
+		ToneMapper m_ToneMapper{ ToneMapper::ACES };
+		float m_Exposure = 1.f;
+
+		// Covers the largest shine of all materials
+		PowTable m_PowTable{ 1.f };
+
+		std::vector<Light> m_Lights{};
+		// Indices into m_Lights, directional lights reach every tile
+		std::vector<uint32_t> m_DirectionalLights{};
+		std::vector<uint32_t> m_LocalLights{};
+
+		// Forward+ light lists, the point and spot lights of tile i are
+		// m_TileLightIndices[m_TileLightOffsets[i]] up to m_TileLightIndices[m_TileLightOffsets[i + 1]]
+		static constexpr int TileSize{ 16 };
+		int m_TileCountX{};
+		int m_TileCountY{};
+		std::vector<uint32_t> m_TileLightOffsets{};
+		std::vector<uint32_t> m_TileLightIndices{};
+
+		// Depth buffer the geometry passes rasterize into, the screen's or the shadow map
+		struct RasterTarget
+		{
+			float* pDepth;
+			int width;
+			int height;
+		};
+		RasterTarget m_RasterTarget{};
+
+		// Orthographic depth from the shadow casting light, -1 when no light casts shadows
+		static constexpr int ShadowMapSize{ 1024 };
+		std::vector<float> m_ShadowMap{};
+		Matrix m_ShadowViewProjection{};
+		float m_ShadowBias{};
+		int m_ShadowLight{ -1 };
+
+		// What the shadow map was last rendered with, it is reused until one of these changes
+		Vector3 m_ShadowLightDirection{};
+		std::vector<Matrix> m_ShadowCasterMatrices{};
+
+		// Camera ray through pixel (x, y) is origin + x * stepX + y * stepY, with a forward component of 1
+		struct ViewRayBasis
+		{
+			Vector3 origin;
+			Vector3 stepX;
+			Vector3 stepY;
+		};
+		ViewRayBasis m_ViewRays{};
+		// Normalized ray per pixel, SoA rows padded to a multiple of 8. Only rebuilt when the camera moves
+		int m_ViewDirectionStride{};
+		std::vector<float> m_ViewDirectionsX{};
+		std::vector<float> m_ViewDirectionsY{};
+		std::vector<float> m_ViewDirectionsZ{};
+
+		// Largest allowed simplification error on screen, in pixels
+		float m_LODPixelError = 1.0f;
+		// Fraction of that error the next level has to be under before switching to it
+		float m_LODHysteresis = 0.7f;
+
+		void TransformPositions(std::span<const Vertex> vertices, const Matrix& worldViewProjectionMatrix);
+		void TransformPositions(const PackedVertexView& stream, const Vector3& minBounds, const Vector3& maxBounds, const Matrix& worldViewProjectionMatrix);
+		bool CullTriangles(const Mesh& mesh, uint32_t lodIndex);
+		void TransformAttributes(std::span<const Vertex> vertices, const Matrix& worldMatrix);
+		void TransformAttributes(const PackedVertexView& stream, const Matrix& worldMatrix);
+
+		void TransformPosition(const Vector3& position, const Matrix& worldViewProjectionMatrix, Vertex_Out& v) const;
+		void TransformAttributes(const Vertex& vertex, const Matrix& worldMatrix, Vertex_Out& v) const;
+
+		// Hands the textures that finished loading to their materials, once per frame
+		void AdoptLoadedTextures();
+		void SortDraws();
+		void SortLights();
+		void BuildTileLightLists();
+		std::span<const uint32_t> GetTileLights(int px, int py) const;
+
+		void UpdateViewRays();
+		Vector3Packet GetViewDirections(int px, int py) const;
 
-		void VertexTransformationFunction(std::vector<Mesh>& meshes) const;
+		void UpdateShadowMap();
+		// Fraction of a 3x3 PCF kernel around each world position that the shadow light reaches
+		__m256 SampleShadow(const Vector3Packet& position, __m256 mask) const;
 
+		bool IsTriangleVisible(const Vertex_Out& v0, const Vertex_Out& v1, const Vertex_Out& v2) const;
+		RasterFunction GetRasterFunction(bool depthOnly) const;
+		template<int... Indices>
+		static constexpr std::array<RasterFunction, sizeof...(Indices)> MakeRasterFunctions(std::integer_sequence<int, Indices...>);
+		template<PipelineState State>
 		void RenderTriangle(const Vertex_Out& v0, const Vertex_Out& v1, const Vertex_Out& v2) const;
-		void RenderMeshes(const std::vector<Mesh>& meshes) const;
+		bool IsInsideFrustum(const Mesh& mesh, const Matrix& worldViewProjectionMatrix) const;
+		void SelectLOD(const Mesh& mesh, MeshInstance& instance) const;
 
-		ColorRGB PixelShading(const Vertex_Out& v) const;
-		ColorRGB Phong(ColorRGB specular, float gloss, Vector3 lightDir, Vector3 viewDir, Vector3 normal) const;
+		// Shades a packet of 8 fragments, lanes outside the coverage mask come back black
+		template<PipelineState State>
+		ColorRGBPacket PixelShading(const FragmentPacket& fragment, std::span<const uint32_t> tileLights) const;
+		template<PipelineState State>
+		ColorRGBPacket Phong(const ColorRGBPacket& specular, __m256 gloss, const Vector3Packet& lightDir, const Vector3Packet& viewDir, const Vector3Packet& normal, __m256 mask) const;
 	};
 }
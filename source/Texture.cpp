@@ -1,37 +1,2031 @@
 #include "Texture.h"
+#include "MappedFile.h"
 #include "Vector2.h"
 #include <SDL_image.h>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cfloat>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <type_traits>
 
 namespace dae
 {
-	Texture::Texture(SDL_Surface* pSurface) :
-		m_pSurface{ pSurface },
-		m_pSurfacePixels{ (uint32_t*)pSurface->pixels }
+	namespace
 	{
+		// Byte to float tables, a gather from 1 KB that stays in L1 instead of a convert and a divide
+		struct ByteTables
+		{
+			std::array<float, 256> unit{};
+			std::array<float, 256> srgbToLinear{};
+
+			ByteTables()
+			{
+				for (int i{}; i < 256; ++i)
+				{
+					const float c = i / 255.f;
+					unit[i] = c;
+					srgbToLinear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+				}
+			}
+		};
+
+		const ByteTables g_ByteTables{};
+
+		ColorRGBPacket UnpackRGBA8(__m256i pixels, const float* pTable)
+		{
+			const __m256i channelMask = _mm256_set1_epi32(0xFF);
+
+			return {
+				_mm256_i32gather_ps(pTable, _mm256_and_si256(pixels, channelMask), sizeof(float)),
+				_mm256_i32gather_ps(pTable, _mm256_and_si256(_mm256_srli_epi32(pixels, 8), channelMask), sizeof(float)),
+				_mm256_i32gather_ps(pTable, _mm256_and_si256(_mm256_srli_epi32(pixels, 16), channelMask), sizeof(float))
+			};
+		}
+
+		__m256 Lerp(__m256 a, __m256 b, __m256 t)
+		{
+			return _mm256_fmadd_ps(_mm256_sub_ps(b, a), t, a);
+		}
+
+		ColorRGBPacket Lerp(const ColorRGBPacket& a, const ColorRGBPacket& b, __m256 t)
+		{
+			return { Lerp(a.r, b.r, t), Lerp(a.g, b.g, t), Lerp(a.b, b.b, t) };
+		}
+
+		MaterialPacket Lerp(const MaterialPacket& a, const MaterialPacket& b, __m256 t)
+		{
+			return { Lerp(a.diffuse, b.diffuse, t), { Lerp(a.normal.x, b.normal.x, t), Lerp(a.normal.y, b.normal.y, t), _mm256_setzero_ps() },
+				Lerp(a.gloss, b.gloss, t), Lerp(a.specular, b.specular, t) };
+		}
+
+		// Byte Shift / 8 of every lane as float
+		template<int Shift>
+		__m256 UnpackByte(__m256i texels)
+		{
+			return _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(texels, Shift), _mm256_set1_epi32(0xFF)));
+		}
+
+		// 64 bit texels gathered 4 at a time back into 8 lanes of their low and high halves
+		void Deinterleave(__m256i first, __m256i second, __m256i& low, __m256i& high)
+		{
+			low = _mm256_permute4x64_epi64(_mm256_castps_si256(
+				_mm256_shuffle_ps(_mm256_castsi256_ps(first), _mm256_castsi256_ps(second), _MM_SHUFFLE(2, 0, 2, 0))), _MM_SHUFFLE(3, 1, 2, 0));
+			high = _mm256_permute4x64_epi64(_mm256_castps_si256(
+				_mm256_shuffle_ps(_mm256_castsi256_ps(first), _mm256_castsi256_ps(second), _MM_SHUFFLE(3, 1, 3, 1))), _MM_SHUFFLE(3, 1, 2, 0));
+		}
+
+		// Bilinear weights with the byte to unit scale folded in
+		struct BilinearWeights
+		{
+			__m256 weight00;
+			__m256 weight10;
+			__m256 weight01;
+			__m256 weight11;
+
+			BilinearWeights(__m256 tx, __m256 ty)
+			{
+				const __m256 toUnit = _mm256_set1_ps(1.f / 255.f);
+				const __m256 sx = _mm256_sub_ps(_mm256_set1_ps(1.f), tx);
+				const __m256 sy = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(1.f), ty), toUnit);
+				const __m256 scaledTy = _mm256_mul_ps(ty, toUnit);
+				weight00 = _mm256_mul_ps(sx, sy);
+				weight10 = _mm256_mul_ps(tx, sy);
+				weight01 = _mm256_mul_ps(sx, scaledTy);
+				weight11 = _mm256_mul_ps(tx, scaledTy);
+			}
+
+			template<int Shift>
+			__m256 Filter(__m256i texel00, __m256i texel10, __m256i texel01, __m256i texel11) const
+			{
+				return _mm256_fmadd_ps(UnpackByte<Shift>(texel11), weight11, _mm256_fmadd_ps(UnpackByte<Shift>(texel01), weight01,
+					_mm256_fmadd_ps(UnpackByte<Shift>(texel10), weight10, _mm256_mul_ps(UnpackByte<Shift>(texel00), weight00))));
+			}
+		};
+
+		// Set associative LRU cache with 64 byte lines, 32 KB and 8 ways like a typical L1
+		struct CacheSimulator
+		{
+			static constexpr int LineBits{ 6 };
+			static constexpr int Sets{ 64 };
+			static constexpr int Ways{ 8 };
+
+			std::array<uint64_t, Sets * Ways> tags{};
+			std::array<uint32_t, Sets * Ways> lastUse{};
+			uint32_t clock{};
+			int misses{};
+
+			CacheSimulator()
+			{
+				tags.fill(~uint64_t{});
+			}
+
+			void Access(uint64_t address)
+			{
+				const uint64_t line = address >> LineBits;
+				const int first = int(line % Sets) * Ways;
+				int victim{ first };
+				++clock;
+
+				for (int way{ first }; way < first + Ways; ++way)
+				{
+					if (tags[way] == line)
+					{
+						lastUse[way] = clock;
+						return;
+					}
+					if (lastUse[way] < lastUse[victim])
+					{
+						victim = way;
+					}
+				}
+
+				++misses;
+				tags[victim] = line;
+				lastUse[victim] = clock;
+			}
+		};
+
+		int WrapTexel(int texel, int size)
+		{
+			return (texel % size + size) % size;
+		}
+
+		// Weighted sum of 2x2 RGBA8 texels
+		ColorRGBPacket FilterBilinear(__m256i texel00, __m256i texel10, __m256i texel01, __m256i texel11, __m256 tx, __m256 ty)
+		{
+			const BilinearWeights weights{ tx, ty };
+			return {
+				weights.Filter<0>(texel00, texel10, texel01, texel11),
+				weights.Filter<8>(texel00, texel10, texel01, texel11),
+				weights.Filter<16>(texel00, texel10, texel01, texel11)
+			};
+		}
+
+		// Folds integer texel coordinates into [0, period)
+		__m256i Repeat(__m256i texel, __m256i period, bool isPowerOfTwo)
+		{
+			if (isPowerOfTwo)
+			{
+				return _mm256_and_si256(texel, _mm256_sub_epi32(period, _mm256_set1_epi32(1)));
+			}
+
+			// No integer divide in AVX2, a float one is exact enough at texture sizes and the clamp
+			// only catches its rounding and coordinates that overflowed to INT_MIN
+			const __m256 quotient = _mm256_floor_ps(_mm256_div_ps(_mm256_cvtepi32_ps(texel), _mm256_cvtepi32_ps(period)));
+			__m256i folded = _mm256_sub_epi32(texel, _mm256_mullo_epi32(_mm256_cvtps_epi32(quotient), period));
+			folded = _mm256_add_epi32(folded, _mm256_and_si256(period, _mm256_cmpgt_epi32(_mm256_setzero_si256(), folded)));
+			return _mm256_min_epi32(_mm256_max_epi32(folded, _mm256_setzero_si256()), _mm256_sub_epi32(period, _mm256_set1_epi32(1)));
+		}
+
+		// Spreads the low 16 bits to the even bits
+		__m256i SpreadBits(__m256i value)
+		{
+			value = _mm256_and_si256(_mm256_or_si256(value, _mm256_slli_epi32(value, 8)), _mm256_set1_epi32(0x00FF00FF));
+			value = _mm256_and_si256(_mm256_or_si256(value, _mm256_slli_epi32(value, 4)), _mm256_set1_epi32(0x0F0F0F0F));
+			value = _mm256_and_si256(_mm256_or_si256(value, _mm256_slli_epi32(value, 2)), _mm256_set1_epi32(0x33333333));
+			return _mm256_and_si256(_mm256_or_si256(value, _mm256_slli_epi32(value, 1)), _mm256_set1_epi32(0x55555555));
+		}
+
+		uint32_t SpreadBits(uint32_t value)
+		{
+			value = (value | (value << 8)) & 0x00FF00FF;
+			value = (value | (value << 4)) & 0x0F0F0F0F;
+			value = (value | (value << 2)) & 0x33333333;
+			return (value | (value << 1)) & 0x55555555;
+		}
+
+		template<TextureAddress Address>
+		__m256i AddressTexels(__m256i texel, __m256i size, bool isPowerOfTwo)
+		{
+			const __m256i last = _mm256_sub_epi32(size, _mm256_set1_epi32(1));
+
+			if constexpr (Address == TextureAddress::Clamp)
+			{
+				return _mm256_min_epi32(_mm256_max_epi32(texel, _mm256_setzero_si256()), last);
+			}
+			else if constexpr (Address == TextureAddress::Wrap)
+			{
+				return Repeat(texel, size, isPowerOfTwo);
+			}
+			else
+			{
+				// Repeats over two tiles with the second one running backwards
+				const __m256i period = _mm256_slli_epi32(size, 1);
+				const __m256i folded = Repeat(texel, period, isPowerOfTwo);
+				const __m256i backwards = _mm256_sub_epi32(_mm256_sub_epi32(period, _mm256_set1_epi32(1)), folded);
+				return _mm256_blendv_epi8(folded, backwards, _mm256_cmpgt_epi32(folded, last));
+			}
+		}
+
+		// Block codecs, the 16 texels of a block in row order. Encoding picks the endpoints and the nearest
+		// palette entry per texel, decoding builds the same palette and looks the indices up
+
+		uint16_t ToRgb565(uint32_t texel)
+		{
+			return uint16_t(((texel & 0xF8) << 8) | ((texel >> 5) & 0x7E0) | ((texel >> 19) & 0x1F));
+		}
+
+		std::array<int, 3> FromRgb565(uint16_t color)
+		{
+			const int r = color >> 11;
+			const int g = (color >> 5) & 0x3F;
+			const int b = color & 0x1F;
+			return { (r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2) };
+		}
+
+		// Four colors when color0 is the larger one, else three and black
+		std::array<uint32_t, 4> GetBC1Palette(uint16_t color0, uint16_t color1)
+		{
+			const std::array<int, 3> first = FromRgb565(color0);
+			const std::array<int, 3> second = FromRgb565(color1);
+			const bool fourColors = color0 > color1;
+			std::array<uint32_t, 4> palette{ 0xFF000000, 0xFF000000, 0xFF000000, fourColors ? 0xFF000000 : 0u };
+
+			for (int c{}; c < 3; ++c)
+			{
+				palette[0] |= uint32_t(first[c]) << (c * 8);
+				palette[1] |= uint32_t(second[c]) << (c * 8);
+				if (fourColors)
+				{
+					palette[2] |= uint32_t((2 * first[c] + second[c]) / 3) << (c * 8);
+					palette[3] |= uint32_t((first[c] + 2 * second[c]) / 3) << (c * 8);
+				}
+				else
+				{
+					palette[2] |= uint32_t((first[c] + second[c]) / 2) << (c * 8);
+				}
+			}
+
+			return palette;
+		}
+
+		// Eight values when value0 is the larger one, else six and the two extremes
+		std::array<uint8_t, 8> GetBC4Palette(int value0, int value1)
+		{
+			std::array<uint8_t, 8> palette{ uint8_t(value0), uint8_t(value1) };
+
+			if (value0 > value1)
+			{
+				for (int i{ 1 }; i < 7; ++i)
+				{
+					palette[i + 1] = uint8_t(((7 - i) * value0 + i * value1 + 3) / 7);
+				}
+			}
+			else
+			{
+				for (int i{ 1 }; i < 5; ++i)
+				{
+					palette[i + 1] = uint8_t(((5 - i) * value0 + i * value1 + 2) / 5);
+				}
+				palette[6] = 0;
+				palette[7] = 255;
+			}
+
+			return palette;
+		}
+
+		int GetChannel(uint32_t texel, int channel)
+		{
+			return int((texel >> (channel * 8)) & 0xFF);
+		}
+
+		// Endpoints are the two texels furthest apart along the principal axis of the block's colors
+		uint64_t EncodeBC1(const std::array<uint32_t, 16>& texels)
+		{
+			float mean[3]{};
+			for (const uint32_t texel : texels)
+			{
+				for (int c{}; c < 3; ++c)
+				{
+					mean[c] += GetChannel(texel, c) / 16.f;
+				}
+			}
+
+			float covariance[3][3]{};
+			for (const uint32_t texel : texels)
+			{
+				for (int i{}; i < 3; ++i)
+				{
+					for (int j{}; j < 3; ++j)
+					{
+						covariance[i][j] += (GetChannel(texel, i) - mean[i]) * (GetChannel(texel, j) - mean[j]);
+					}
+				}
+			}
+
+			// A few power iterations settle on the largest eigenvector
+			float axis[3]{ 1.f, 1.f, 1.f };
+			for (int iteration{}; iteration < 4; ++iteration)
+			{
+				float next[3]{};
+				for (int i{}; i < 3; ++i)
+				{
+					next[i] = covariance[i][0] * axis[0] + covariance[i][1] * axis[1] + covariance[i][2] * axis[2];
+				}
+
+				const float length = std::max({ fabsf(next[0]), fabsf(next[1]), fabsf(next[2]) });
+				if (length < FLT_EPSILON)
+				{
+					break;
+				}
+				for (int i{}; i < 3; ++i)
+				{
+					axis[i] = next[i] / length;
+				}
+			}
+
+			int lowest{};
+			int highest{};
+			float lowestProjection{ FLT_MAX };
+			float highestProjection{ -FLT_MAX };
+			for (int i{}; i < 16; ++i)
+			{
+				const float projection = GetChannel(texels[i], 0) * axis[0] + GetChannel(texels[i], 1) * axis[1] + GetChannel(texels[i], 2) * axis[2];
+				if (projection < lowestProjection)
+				{
+					lowestProjection = projection;
+					lowest = i;
+				}
+				if (projection > highestProjection)
+				{
+					highestProjection = projection;
+					highest = i;
+				}
+			}
+
+			uint16_t color0 = ToRgb565(texels[highest]);
+			uint16_t color1 = ToRgb565(texels[lowest]);
+			if (color0 < color1)
+			{
+				std::swap(color0, color1);
+			}
+
+			uint64_t block = color0 | uint64_t(color1) << 16;
+			if (color0 == color1)
+			{
+				return block;
+			}
+
+			const std::array<uint32_t, 4> palette = GetBC1Palette(color0, color1);
+			for (int i{}; i < 16; ++i)
+			{
+				int nearest{};
+				int nearestDistance{ INT_MAX };
+				for (int entry{}; entry < 4; ++entry)
+				{
+					int distance{};
+					for (int c{}; c < 3; ++c)
+					{
+						const int difference = GetChannel(texels[i], c) - GetChannel(palette[entry], c);
+						distance += difference * difference;
+					}
+					if (distance < nearestDistance)
+					{
+						nearestDistance = distance;
+						nearest = entry;
+					}
+				}
+				block |= uint64_t(nearest) << (32 + 2 * i);
+			}
+
+			return block;
+		}
+
+		// One channel of the block, the range of its values as the endpoints
+		uint64_t EncodeBC4(const std::array<uint32_t, 16>& texels, int channel)
+		{
+			int lowest{ 255 };
+			int highest{};
+			for (const uint32_t texel : texels)
+			{
+				lowest = std::min(lowest, GetChannel(texel, channel));
+				highest = std::max(highest, GetChannel(texel, channel));
+			}
+
+			uint64_t block = uint64_t(highest) | uint64_t(lowest) << 8;
+			const std::array<uint8_t, 8> palette = GetBC4Palette(highest, lowest);
+
+			for (int i{}; i < 16; ++i)
+			{
+				const int value = GetChannel(texels[i], channel);
+				int nearest{};
+				for (int entry{ 1 }; entry < 8; ++entry)
+				{
+					if (std::abs(palette[entry] - value) < std::abs(palette[nearest] - value))
+					{
+						nearest = entry;
+					}
+				}
+				block |= uint64_t(nearest) << (16 + 3 * i);
+			}
+
+			return block;
+		}
+
+		std::array<uint8_t, 16> DecodeBC4(uint64_t block)
+		{
+			const std::array<uint8_t, 8> palette = GetBC4Palette(int(block & 0xFF), int((block >> 8) & 0xFF));
+			std::array<uint8_t, 16> values{};
+
+			for (int i{}; i < 16; ++i)
+			{
+				values[i] = palette[(block >> (16 + 3 * i)) & 7];
+			}
+
+			return values;
+		}
+
+		// Precedes the level sizes and the texels in a cache file
+		struct CacheHeader
+		{
+			uint32_t magic;
+			uint32_t version;
+			uint64_t sourceHash;
+			int32_t storage;
+			int32_t layout;
+			int32_t width;
+			int32_t height;
+			int32_t levelCount;
+			int32_t blockWords;
+		};
+
+		constexpr uint32_t CacheMagic{ 0x43585444 }; // "DTXC"
+		// The texels start at a cache line
+		constexpr size_t CacheAlignment{ 64 };
+		// Keeps the texel offsets of every level inside an int
+		constexpr int MaxCacheSize{ 16384 };
+
+		// FNV-1a, only has to tell sources apart
+		uint64_t HashFile(const std::string& path)
+		{
+			const MappedFile file{ path };
+			uint64_t hash{ 0xCBF29CE484222325ull };
+
+			for (size_t i{}; i < file.GetSize(); ++i)
+			{
+				hash = (hash ^ file.GetData()[i]) * 0x100000001B3ull;
+			}
+
+			return hash;
+		}
+
+		std::string GetCachePath(const std::string& path, TextureStorage storage, TextureLayout layout)
+		{
+			constexpr const char* storageNames[]{ "rgba8", "float", "material", "bc1", "bc4", "bc5" };
+			constexpr const char* layoutNames[]{ "linear", "tiled", "morton" };
+			return path + "." + storageNames[int(storage)] + "." + layoutNames[int(layout)] + ".texcache";
+		}
+
+		size_t GetCacheTexelOffset(int levelCount)
+		{
+			const size_t tableEnd = sizeof(CacheHeader) + 2 * sizeof(int32_t) * levelCount;
+			return (tableEnd + CacheAlignment - 1) / CacheAlignment * CacheAlignment;
+		}
+
+		// fseek takes a long, which is 32 bits on Windows and can't reach past 2 GB
+		bool SeekFile(FILE* pFile, uint64_t offset)
+		{
+#ifdef _WIN32
+			return _fseeki64(pFile, int64_t(offset), SEEK_SET) == 0;
+#else
+			return fseeko(pFile, off_t(offset), SEEK_SET) == 0;
+#endif
+		}
+	}
+
+	Texture::Texture(int width, int height, TextureStorage storage) :
+		m_Width{ width },
+		m_Height{ height },
+		m_Storage{ storage },
+		m_IsPowerOfTwo{ (width & (width - 1)) == 0 && (height & (height - 1)) == 0 },
+		m_BlockWords{ storage == TextureStorage::Material ? 16 : 8 }
+	{
+	}
+
+	Texture* Texture::LoadFromFile(const std::string& path, TextureStorage storage, TextureLayout layout)
+	{
+		// Hashing the source is far cheaper than decoding it
+		const uint64_t sourceHash = HashFile(path);
+		const std::string cachePath = GetCachePath(path, storage, layout);
+
+		if (Texture* pCached = LoadFromCache(cachePath, sourceHash, storage))
+		{
+			pCached->m_SourcePath = path;
+			pCached->m_SourceHash = sourceHash;
+			return pCached;
+		}
+
+		SDL_Surface* pLoaded = IMG_Load(path.c_str());
+		if (!pLoaded)
+		{
+			std::cout << "Failed to load " << path << ": " << IMG_GetError() << "\n";
+			return nullptr;
+		}
+
+		// ABGR8888 packs R in the lowest byte of each 32 bit texel
+		SDL_Surface* pSurface = SDL_ConvertSurfaceFormat(pLoaded, SDL_PIXELFORMAT_ABGR8888, 0);
+		SDL_FreeSurface(pLoaded);
+		if (!pSurface)
+		{
+			return nullptr;
+		}
+
+		// Block formats are encoded from the RGBA8 levels
+		const bool isCompressed = storage == TextureStorage::BC1 || storage == TextureStorage::BC4 || storage == TextureStorage::BC5;
+		Texture* pTexture = new Texture(pSurface->w, pSurface->h, isCompressed ? TextureStorage::RGBA8 : storage);
+		pTexture->m_Pixels.resize(size_t(pSurface->w) * pSurface->h);
+
+		for (int y{}; y < pSurface->h; ++y)
+		{
+			const uint32_t* pRow = reinterpret_cast<const uint32_t*>(static_cast<const uint8_t*>(pSurface->pixels) + y * pSurface->pitch);
+			std::copy(pRow, pRow + pSurface->w, pTexture->m_Pixels.begin() + y * pSurface->w);
+		}
+
+		SDL_FreeSurface(pSurface);
+
+		pTexture->GenerateMips(pTexture->m_Pixels);
+
+		if (storage == TextureStorage::Float)
+		{
+			pTexture->m_FloatPixels.reserve(pTexture->m_Pixels.size() * 4);
+
+			for (const uint32_t pixel : pTexture->m_Pixels)
+			{
+				for (int c{}; c < 4; ++c)
+				{
+					pTexture->m_FloatPixels.push_back(g_ByteTables.unit[(pixel >> (c * 8)) & 0xFF]);
+				}
+			}
+
+			// Only one of the two copies is ever sampled
+			pTexture->m_Pixels = {};
+		}
+
+		if (isCompressed)
+		{
+			pTexture->Compress(storage);
+		}
+		else if (layout != TextureLayout::Linear)
+		{
+			pTexture->SetLayout(layout);
+		}
+
+		// The first run then reads the same mapping as every later one
+		pTexture->WriteCache(cachePath, sourceHash);
+		if (Texture* pCached = LoadFromCache(cachePath, sourceHash, storage))
+		{
+			delete pTexture;
+			pTexture = pCached;
+		}
+
+		pTexture->m_SourcePath = path;
+		pTexture->m_SourceHash = sourceHash;
+		return pTexture;
 	}
 
-	Texture::~Texture()
+	Texture* Texture::PackMaterial(const Texture& diffuse, const Texture& normal, const Texture& gloss, const Texture& specular, float shine)
 	{
-		if (m_pSurface)
+		// Tiled, so a virtual packed material pages straight from the cache file
+		const Texture* const pMaps[]{ &diffuse, &normal, &gloss, &specular };
+		const bool isCached = std::all_of(std::begin(pMaps), std::end(pMaps), [](const Texture* pMap) { return !pMap->m_SourcePath.empty(); });
+		const std::string cachePath = GetCachePath(diffuse.m_SourcePath, TextureStorage::Material, TextureLayout::Tiled);
+
+		// FNV-1a over the sources' hashes, the storages they were read from and the shine
+		uint64_t sourceHash{ 0xCBF29CE484222325ull };
+		for (const Texture* pMap : pMaps)
+		{
+			sourceHash = (sourceHash ^ pMap->m_SourceHash) * 0x100000001B3ull;
+			sourceHash = (sourceHash ^ uint64_t(pMap->m_Storage)) * 0x100000001B3ull;
+		}
+		sourceHash = (sourceHash ^ std::bit_cast<uint32_t>(shine)) * 0x100000001B3ull;
+
+		if (isCached)
+		{
+			if (Texture* pCached = LoadFromCache(cachePath, sourceHash, TextureStorage::Material))
+			{
+				pCached->m_GlossScale = shine;
+				return pCached;
+			}
+		}
+
+		Texture* pTexture = new Texture(diffuse.m_Width, diffuse.m_Height, TextureStorage::Material);
+		pTexture->m_GlossScale = shine;
+		pTexture->m_MaterialTexels.resize(size_t(diffuse.m_Width) * diffuse.m_Height);
+
+		const auto toByte = [](float value) { return uint64_t(std::clamp(value, 0.f, 1.f) * 255.f + 0.5f); };
+
+		// Read at the diffuse texel centers, the other maps may differ in size, storage or layout
+		for (int y{}; y < diffuse.m_Height; ++y)
+		{
+			for (int x{}; x < diffuse.m_Width; ++x)
+			{
+				const Vector2 uv{ (x + 0.5f) / diffuse.m_Width, (y + 0.5f) / diffuse.m_Height };
+				const ColorRGB albedo = diffuse.Sample(uv);
+				const ColorRGB tangentNormal = normal.Sample(uv);
+				const ColorRGB specularColor = specular.Sample(uv);
+
+				pTexture->m_MaterialTexels[y * size_t(diffuse.m_Width) + x] =
+					toByte(albedo.r) | toByte(albedo.g) << 8 | toByte(albedo.b) << 16 |
+					toByte(tangentNormal.r) << 24 | toByte(tangentNormal.g) << 32 |
+					toByte(gloss.Sample(uv).r) << 40 |
+					toByte((specularColor.r + specularColor.g + specularColor.b) / 3.f) << 48;
+			}
+		}
+
+		pTexture->GenerateMips(pTexture->m_MaterialTexels);
+
+		if (isCached)
 		{
-			SDL_FreeSurface(m_pSurface);
-			m_pSurface = nullptr;
+			pTexture->SetLayout(TextureLayout::Tiled);
+			pTexture->WriteCache(cachePath, sourceHash);
+			if (Texture* pCached = LoadFromCache(cachePath, sourceHash, TextureStorage::Material))
+			{
+				pCached->m_GlossScale = shine;
+				delete pTexture;
+				pTexture = pCached;
+			}
 		}
+
+		return pTexture;
 	}
 
-	Texture* Texture::LoadFromFile(const std::string& path)
+	Texture* Texture::CreateSolid(const ColorRGB& color)
 	{
-		return new Texture(IMG_Load(path.c_str()));
+		Texture* pTexture = new Texture(1, 1, TextureStorage::RGBA8);
+		const auto toByte = [](float value) { return uint32_t(std::clamp(value, 0.f, 1.f) * 255.f + 0.5f); };
+
+		pTexture->m_Pixels = { 0xFF000000 | toByte(color.b) << 16 | toByte(color.g) << 8 | toByte(color.r) };
+		pTexture->GenerateMips(pTexture->m_Pixels);
+		return pTexture;
 	}
 
 	ColorRGB Texture::Sample(const Vector2& uv) const
 	{
-		int x = uv.x * m_pSurface->w;
-		int y = uv.y * m_pSurface->h;
+		const int x = std::min(int((uv.x - floorf(uv.x)) * m_Width), m_Width - 1);
+		const int y = std::min(int((uv.y - floorf(uv.y)) * m_Height), m_Height - 1);
+		const size_t index = GetTexelIndex(x, y, 0);
+
+		if (m_Storage == TextureStorage::Float)
+		{
+			const float* pTexel = GetTexels(m_FloatPixels) + index * 4;
+			return { pTexel[0], pTexel[1], pTexel[2] };
+		}
+
+		const uint32_t pixel = m_Storage == TextureStorage::Material ? uint32_t(m_IsVirtual ? ReadMaterialTexel(int(index)) : GetTexels(m_MaterialTexels)[index]) :
+			IsCompressed() || m_IsVirtual ? ReadBlockTexel(int(index)) : GetTexels(m_Pixels)[index];
+		return { g_ByteTables.unit[pixel & 0xFF], g_ByteTables.unit[(pixel >> 8) & 0xFF], g_ByteTables.unit[(pixel >> 16) & 0xFF] };
+	}
+
+	ColorRGBPacket Texture::SampleLevel(const Vector2Packet& uv, __m256 lod, const SamplerState& sampler, __m256 mask) const
+	{
+		return Sample(uv, lod, sampler, false, mask);
+	}
+
+	ColorRGBPacket Texture::SampleGrad(const Vector2Packet& uv, const Vector2Packet& ddx, const Vector2Packet& ddy, const SamplerState& sampler, __m256 mask) const
+	{
+		return Sample(uv, GetLod(ddx, ddy), sampler, false, mask);
+	}
+
+	ColorRGBPacket Texture::SampleGradLinear(const Vector2Packet& uv, const Vector2Packet& ddx, const Vector2Packet& ddy, const SamplerState& sampler, __m256 mask) const
+	{
+		return Sample(uv, GetLod(ddx, ddy), sampler, true, mask);
+	}
+
+	MaterialPacket Texture::SampleMaterial(const Vector2Packet& uv, const Vector2Packet& ddx, const Vector2Packet& ddy, const SamplerState& sampler, bool decodeSrgb, __m256 mask) const
+	{
+		const __m256 lod = GetLod(ddx, ddy);
+		MaterialPacket material{};
+
+		switch (sampler.address)
+		{
+		case TextureAddress::Clamp:
+			material = SampleWith<TextureAddress::Clamp, MaterialPacket>(uv, lod, sampler.filter, false, mask);
+			break;
+		case TextureAddress::Mirror:
+			material = SampleWith<TextureAddress::Mirror, MaterialPacket>(uv, lod, sampler.filter, false, mask);
+			break;
+		default:
+			material = SampleWith<TextureAddress::Wrap, MaterialPacket>(uv, lod, sampler.filter, false, mask);
+			break;
+		}
+
+		if (decodeSrgb)
+		{
+			material.diffuse = { SrgbToLinear(material.diffuse.r), SrgbToLinear(material.diffuse.g), SrgbToLinear(material.diffuse.b) };
+		}
+
+		// Remap to [-1, 1] and rebuild z, tangent space normals always face out of the surface
+		const __m256 one = _mm256_set1_ps(1.f);
+		const __m256 two = _mm256_set1_ps(2.f);
+		Vector3Packet& normal = material.normal;
+		normal.x = _mm256_fmsub_ps(normal.x, two, one);
+		normal.y = _mm256_fmsub_ps(normal.y, two, one);
+		normal.z = _mm256_sqrt_ps(_mm256_max_ps(_mm256_fnmadd_ps(normal.y, normal.y, _mm256_fnmadd_ps(normal.x, normal.x, one)), _mm256_setzero_ps()));
+
+		material.gloss = _mm256_mul_ps(material.gloss, _mm256_set1_ps(m_GlossScale));
+		return material;
+	}
+
+	void Texture::Compress(TextureStorage format)
+	{
+		assert(m_Storage == TextureStorage::RGBA8);
+
+		// Each block is then 16 consecutive texels, edge blocks padded
+		SetLayout(TextureLayout::Tiled);
+		m_BlockWords = format == TextureStorage::BC5 ? 2 : 1;
+		m_Blocks.resize((m_Pixels.size() / 16) * m_BlockWords);
+
+		for (int level{}; level < GetLevelCount(); ++level)
+		{
+			const int width = m_LevelWidths[level];
+			const int height = m_LevelHeights[level];
+
+			for (int blockY{}; blockY < height; blockY += 4)
+			{
+				for (int blockX{}; blockX < width; blockX += 4)
+				{
+					// Padding repeats the edge texels so it doesn't pull the endpoints off
+					std::array<uint32_t, 16> texels{};
+					for (int i{}; i < 16; ++i)
+					{
+						texels[i] = m_Pixels[GetTexelIndex(std::min(blockX + (i & 3), width - 1), std::min(blockY + (i >> 2), height - 1), level)];
+					}
+
+					uint64_t* pBlock = &m_Blocks[size_t(GetTexelIndex(blockX, blockY, level) >> 4) * m_BlockWords];
+					switch (format)
+					{
+					case TextureStorage::BC1:
+						pBlock[0] = EncodeBC1(texels);
+						break;
+					case TextureStorage::BC4:
+						pBlock[0] = EncodeBC4(texels, 0);
+						break;
+					default:
+						pBlock[0] = EncodeBC4(texels, 0);
+						pBlock[1] = EncodeBC4(texels, 1);
+						break;
+					}
+				}
+			}
+		}
+
+		m_Pixels = {};
+		m_Storage = format;
+		InitBlockCache();
+	}
+
+	bool Texture::IsCompressed() const
+	{
+		return m_Storage == TextureStorage::BC1 || m_Storage == TextureStorage::BC4 || m_Storage == TextureStorage::BC5;
+	}
+
+	void Texture::MakeVirtual(int pageBudget)
+	{
+		assert((m_Storage == TextureStorage::RGBA8 || m_Storage == TextureStorage::Material || IsCompressed()) && !m_IsVirtual);
+
+		// Pages are cut from the 4x4 blocks. A mapping that is still there after this is already tiled
+		if (m_Layout != TextureLayout::Tiled)
+		{
+			SetLayout(TextureLayout::Tiled);
+		}
+
+		const int pageBlocks = 1 << PageBlockBits;
+		const size_t pageWords = size_t(pageBlocks) * pageBlocks * m_BlockWords;
+		std::vector<int> pinnedPages{};
+		std::vector<int> levelPageOffsets{};
+		std::vector<int> levelPagesPerRow{};
+		int pageCount{};
+
+		for (int level{}; level < GetLevelCount(); ++level)
+		{
+			const int pagesX = (m_LevelStrides[level] + pageBlocks - 1) >> PageBlockBits;
+			const int pagesY = ((m_LevelHeights[level] + 3) / 4 + pageBlocks - 1) >> PageBlockBits;
+			levelPageOffsets.push_back(pageCount);
+			levelPagesPerRow.push_back(pagesX);
+
+			// The mip tail is small and where every fallback ends, it stays resident
+			if (pagesX * pagesY == 1)
+			{
+				pinnedPages.push_back(pageCount);
+			}
+
+			pageCount += pagesX * pagesY;
+		}
+
+		// A mapped cache file is paged from directly, anything else goes out to a temporary file first
+		std::shared_ptr<FILE> pPageFile{};
+		if (!m_pMapping)
+		{
+			FILE* pFile = std::tmpfile();
+			if (!pFile)
+			{
+				// Stays fully resident
+				return;
+			}
+			pPageFile.reset(pFile, &fclose);
+
+			std::vector<uint64_t> page(pageWords);
+			for (int level{}; level < GetLevelCount(); ++level)
+			{
+				const int pages = (level + 1 < GetLevelCount() ? levelPageOffsets[level + 1] : pageCount) - levelPageOffsets[level];
+
+				for (int i{}; i < pages; ++i)
+				{
+					CopyPage(level, i % levelPagesPerRow[level], i / levelPagesPerRow[level], page.data());
+
+					// A short write leaves the texture resident as it is
+					if (fwrite(page.data(), sizeof(uint64_t), pageWords, pFile) != pageWords)
+					{
+						return;
+					}
+				}
+			}
+
+			if (fflush(pFile) != 0)
+			{
+				return;
+			}
+		}
+
+		m_pPageFile = std::move(pPageFile);
+		m_LevelPageOffsets = std::move(levelPageOffsets);
+		m_LevelPagesPerRow = std::move(levelPagesPerRow);
+		m_PageTable.assign(pageCount, -1);
+		m_PageRequests.assign(pageCount, 0);
+
+		const int slotCount = std::clamp(pageBudget, int(pinnedPages.size()), pageCount);
+		m_SlotPages.assign(slotCount, -1);
+		m_SlotLastUse.assign(slotCount, 0);
+		// Only the slots in use are allocated. Free slots are taken in order, the reserve keeps the blocks of the
+		// others in place as they are added
+		m_SlotBlocks.reserve(size_t(slotCount) * pageWords);
+		m_SlotBlocks.resize(pinnedPages.size() * pageWords);
+
+		// The first slots, cut while the texels are still at hand and never older than the current frame so
+		// never evicted
+		for (int slot{}; slot < int(pinnedPages.size()); ++slot)
+		{
+			int level, pageX, pageY;
+			LocatePage(pinnedPages[slot], level, pageX, pageY);
+			CopyPage(level, pageX, pageY, &m_SlotBlocks[slot * pageWords]);
+			m_PageTable[pinnedPages[slot]] = slot;
+			m_SlotPages[slot] = pinnedPages[slot];
+			m_SlotLastUse[slot] = UINT32_MAX;
+		}
+
+		m_Pixels = {};
+		m_MaterialTexels = {};
+		m_Blocks = {};
+		if (m_pPageFile)
+		{
+			m_pMapping = {};
+		}
+		m_IsVirtual = true;
+
+		InitBlockCache();
+	}
+
+	void Texture::UpdatePages()
+	{
+		if (!m_IsVirtual)
+		{
+			return;
+		}
+
+		int loads{};
+
+		// Coarser levels come later in the file, so fallbacks sharpen one level at a time
+		for (int page{ int(m_PageTable.size()) - 1 }; page >= 0 && loads < MaxPageLoads; --page)
+		{
+			if (m_PageRequests[page] != m_Frame || m_PageTable[page] >= 0)
+			{
+				continue;
+			}
+
+			// Free slots were never used, pinned ones and those read this frame are never below the frame
+			int victim{ -1 };
+			for (int slot{}; slot < int(m_SlotPages.size()); ++slot)
+			{
+				if (m_SlotLastUse[slot] < m_Frame && (victim < 0 || m_SlotLastUse[slot] < m_SlotLastUse[victim]))
+				{
+					victim = slot;
+				}
+			}
+
+			if (victim < 0)
+			{
+				break;
+			}
+
+			LoadPage(page, victim);
+			++loads;
+		}
+
+		++m_Frame;
+	}
+
+	void Texture::LoadPage(int page, int slot)
+	{
+		const size_t pageWords = size_t(m_BlockWords) << (2 * PageBlockBits);
+
+		if (m_SlotPages[slot] >= 0)
+		{
+			m_PageTable[m_SlotPages[slot]] = -1;
+			m_SlotPages[slot] = -1;
+		}
+
+		if (m_SlotBlocks.size() < (slot + 1) * pageWords)
+		{
+			m_SlotBlocks.resize((slot + 1) * pageWords);
+		}
+
+		if (m_pPageFile)
+		{
+			// A failed read leaves the slot free and the page missing, its reads keep falling back
+			if (!SeekFile(m_pPageFile.get(), uint64_t(page) * pageWords * sizeof(uint64_t)) ||
+				fread(&m_SlotBlocks[slot * pageWords], sizeof(uint64_t), pageWords, m_pPageFile.get()) != pageWords)
+			{
+				return;
+			}
+		}
+		else
+		{
+			int level, pageX, pageY;
+			LocatePage(page, level, pageX, pageY);
+			CopyPage(level, pageX, pageY, &m_SlotBlocks[slot * pageWords]);
+		}
 
-		Uint8 r, g, b;
-		SDL_GetRGB(m_pSurfacePixels[x + (y * m_pSurface->w)], m_pSurface->format, &r, &g, &b);
+		m_PageTable[page] = slot;
+		m_SlotPages[slot] = page;
+		m_SlotLastUse[slot] = m_Frame;
+	}
 
-		return { r / 255.0f, g / 255.0f, b / 255.0f };
+	void Texture::LocatePage(int page, int& level, int& pageX, int& pageY) const
+	{
+		level = int(std::upper_bound(m_LevelPageOffsets.begin(), m_LevelPageOffsets.end(), page) - m_LevelPageOffsets.begin()) - 1;
+		const int local = page - m_LevelPageOffsets[level];
+		pageX = local % m_LevelPagesPerRow[level];
+		pageY = local / m_LevelPagesPerRow[level];
+	}
+
+	void Texture::CopyPage(int level, int pageX, int pageY, uint64_t* pTarget) const
+	{
+		const int pageBlocks = 1 << PageBlockBits;
+		const int blocksX = m_LevelStrides[level];
+		const int blocksY = (m_LevelHeights[level] + 3) / 4;
+		const size_t blockBytes = size_t(m_BlockWords) * sizeof(uint64_t);
+		// Tiled RGBA8 and material texels are 4x4 blocks of 16 texels as well
+		const uint8_t* pSource = IsCompressed() ? reinterpret_cast<const uint8_t*>(GetTexels(m_Blocks)) :
+			m_Storage == TextureStorage::Material ? reinterpret_cast<const uint8_t*>(GetTexels(m_MaterialTexels)) : reinterpret_cast<const uint8_t*>(GetTexels(m_Pixels));
+
+		std::fill_n(pTarget, size_t(m_BlockWords) << (2 * PageBlockBits), uint64_t{});
+
+		// The blocks of a page row are consecutive in the level as well
+		const int columns = std::min(pageBlocks, blocksX - pageX * pageBlocks);
+		for (int y{}; y < pageBlocks && pageY * pageBlocks + y < blocksY; ++y)
+		{
+			const size_t block = size_t(m_LevelOffsets[level] / 16) + size_t(pageY * pageBlocks + y) * blocksX + size_t(pageX) * pageBlocks;
+			memcpy(pTarget + size_t(y) * pageBlocks * m_BlockWords, pSource + block * blockBytes, columns * blockBytes);
+		}
+	}
+
+	size_t Texture::GetMemorySize() const
+	{
+		// A virtual texture only reads pages out of its mapping, the resident ones are counted in the slots
+		const size_t mappedBytes = m_pMapping && !m_IsVirtual ? m_pMapping->GetSize() - m_MappedTexelOffset : 0;
+		return m_Pixels.size() * sizeof(uint32_t) + m_FloatPixels.size() * sizeof(float) + m_MaterialTexels.size() * sizeof(uint64_t) +
+			m_Blocks.size() * sizeof(uint64_t) + m_SlotBlocks.size() * sizeof(uint64_t) + mappedBytes;
+	}
+
+	Texture* Texture::LoadFromCache(const std::string& cachePath, uint64_t sourceHash, TextureStorage storage)
+	{
+		auto pFile = std::make_shared<const MappedFile>(cachePath);
+		if (pFile->GetSize() < sizeof(CacheHeader))
+		{
+			return nullptr;
+		}
+
+		CacheHeader header{};
+		memcpy(&header, pFile->GetData(), sizeof(header));
+
+		// A stale or foreign file is just rebuilt and overwritten
+		const size_t texelOffset = GetCacheTexelOffset(header.levelCount);
+		if (header.magic != CacheMagic || header.version != CacheVersion || header.sourceHash != sourceHash ||
+			header.storage != int32_t(storage) || header.layout < 0 || header.layout >= int32_t(TextureLayout::End) ||
+			header.width <= 0 || header.height <= 0 || header.width > MaxCacheSize || header.height > MaxCacheSize ||
+			header.levelCount <= 0 || header.levelCount > 32 || pFile->GetSize() < texelOffset)
+		{
+			return nullptr;
+		}
+
+		Texture* pTexture = new Texture(header.width, header.height, storage);
+		pTexture->m_Layout = TextureLayout(header.layout);
+		pTexture->m_BlockWords = header.blockWords;
+
+		const uint8_t* pSizes = pFile->GetData() + sizeof(header);
+		for (std::vector<int>* pLevels : { &pTexture->m_LevelWidths, &pTexture->m_LevelHeights })
+		{
+			pLevels->resize(header.levelCount);
+			memcpy(pLevels->data(), pSizes, header.levelCount * sizeof(int32_t));
+			pSizes += header.levelCount * sizeof(int32_t);
+		}
+		pTexture->m_LevelOffsets.resize(header.levelCount);
+		pTexture->m_LevelStrides.resize(header.levelCount);
+
+		// The level table has to be the mip chain of the header's size, down to a single texel
+		int width{ header.width };
+		int height{ header.height };
+		for (int level{}; level < header.levelCount; ++level)
+		{
+			if (pTexture->m_LevelWidths[level] != width || pTexture->m_LevelHeights[level] != height || ((width == 1 && height == 1) != (level == header.levelCount - 1)))
+			{
+				delete pTexture;
+				return nullptr;
+			}
+
+			width = std::max(width / 2, 1);
+			height = std::max(height / 2, 1);
+		}
+
+		const int expectedBlockWords = storage == TextureStorage::BC5 ? 2 : storage == TextureStorage::BC1 || storage == TextureStorage::BC4 ? 1 :
+			storage == TextureStorage::Material ? 16 : 8;
+		if (header.blockWords != expectedBlockWords)
+		{
+			delete pTexture;
+			return nullptr;
+		}
+
+		// Blocks per 16 texels, the other storages keep the spare texel at the end
+		const size_t texelCount = pTexture->LayOutLevels();
+		const size_t texelBytes = pTexture->IsCompressed() ? texelCount / 16 * header.blockWords * sizeof(uint64_t) :
+			(texelCount + 1) * (storage == TextureStorage::Float ? 4 * sizeof(float) : storage == TextureStorage::Material ? sizeof(uint64_t) : sizeof(uint32_t));
+		if (pFile->GetSize() != texelOffset + texelBytes)
+		{
+			delete pTexture;
+			return nullptr;
+		}
+
+		pTexture->m_MappedTexelOffset = texelOffset;
+		pTexture->m_pMapping = std::move(pFile);
+
+		if (pTexture->IsCompressed())
+		{
+			pTexture->InitBlockCache();
+		}
+
+		return pTexture;
+	}
+
+	void Texture::WriteCache(const std::string& cachePath, uint64_t sourceHash) const
+	{
+		std::ofstream file{ cachePath, std::ios::binary | std::ios::trunc };
+		if (!file)
+		{
+			return;
+		}
+
+		const CacheHeader header{ CacheMagic, CacheVersion, sourceHash, int32_t(m_Storage), int32_t(m_Layout), m_Width, m_Height, GetLevelCount(), m_BlockWords };
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		for (const std::vector<int>* pLevels : { &m_LevelWidths, &m_LevelHeights })
+		{
+			file.write(reinterpret_cast<const char*>(pLevels->data()), pLevels->size() * sizeof(int32_t));
+		}
+
+		const size_t padding = GetCacheTexelOffset(GetLevelCount()) - sizeof(header) - 2 * sizeof(int32_t) * GetLevelCount();
+		const char zeros[CacheAlignment]{};
+		file.write(zeros, padding);
+
+		const auto writeTexels = [&file](const auto& texels)
+		{
+			file.write(reinterpret_cast<const char*>(texels.data()), texels.size() * sizeof(texels[0]));
+		};
+
+		if (m_Storage == TextureStorage::Float)
+		{
+			writeTexels(m_FloatPixels);
+		}
+		else if (m_Storage == TextureStorage::Material)
+		{
+			writeTexels(m_MaterialTexels);
+		}
+		else if (IsCompressed())
+		{
+			writeTexels(m_Blocks);
+		}
+		else
+		{
+			writeTexels(m_Pixels);
+		}
+	}
+
+	template<typename Texel>
+	const Texel* Texture::GetTexels(const std::vector<Texel>& texels) const
+	{
+		return m_pMapping ? reinterpret_cast<const Texel*>(m_pMapping->GetData() + m_MappedTexelOffset) : texels.data();
+	}
+
+	void Texture::Unmap()
+	{
+		if (!m_pMapping)
+		{
+			return;
+		}
+
+		const uint8_t* pTexels = m_pMapping->GetData() + m_MappedTexelOffset;
+		const size_t byteCount = m_pMapping->GetSize() - m_MappedTexelOffset;
+		const auto copy = [pTexels, byteCount](auto& texels)
+		{
+			texels.resize(byteCount / sizeof(texels[0]));
+			memcpy(texels.data(), pTexels, byteCount);
+		};
+
+		if (m_Storage == TextureStorage::Float)
+		{
+			copy(m_FloatPixels);
+		}
+		else if (m_Storage == TextureStorage::Material)
+		{
+			copy(m_MaterialTexels);
+		}
+		else if (IsCompressed())
+		{
+			copy(m_Blocks);
+		}
+		else
+		{
+			copy(m_Pixels);
+		}
+
+		m_pMapping = {};
+	}
+
+	void Texture::InitBlockCache()
+	{
+		m_CachedBlocks.assign(size_t(1) << BlockCacheBits, -1);
+		if (m_Storage == TextureStorage::Material)
+		{
+			m_CachedMaterialTexels.resize(size_t(16) << BlockCacheBits);
+		}
+		else
+		{
+			m_CachedTexels.resize(size_t(16) << BlockCacheBits);
+		}
+	}
+
+	void Texture::SetLayout(TextureLayout layout)
+	{
+		if (IsCompressed() || m_IsVirtual)
+		{
+			return;
+		}
+
+		Unmap();
+
+		if (layout == TextureLayout::Morton && !m_IsPowerOfTwo)
+		{
+			layout = TextureLayout::Tiled;
+		}
+
+		// Where every texel sits now, level by level and row by row
+		std::vector<int> sourceIndices{};
+		for (int level{}; level < GetLevelCount(); ++level)
+		{
+			for (int y{}; y < m_LevelHeights[level]; ++y)
+			{
+				for (int x{}; x < m_LevelWidths[level]; ++x)
+				{
+					sourceIndices.push_back(GetTexelIndex(x, y, level));
+				}
+			}
+		}
+
+		m_Layout = layout;
+		const size_t texelCount = LayOutLevels();
+
+		const auto reorder = [this, texelCount, &sourceIndices](auto& texels, int components)
+		{
+			// Tile padding stays zero, the spare texel at the end is kept
+			std::remove_reference_t<decltype(texels)> reordered((texelCount + 1) * components);
+			size_t source{};
+
+			for (int level{}; level < GetLevelCount(); ++level)
+			{
+				for (int y{}; y < m_LevelHeights[level]; ++y)
+				{
+					for (int x{}; x < m_LevelWidths[level]; ++x)
+					{
+						const size_t from = size_t(sourceIndices[source++]) * components;
+						std::copy_n(texels.begin() + from, components, reordered.begin() + size_t(GetTexelIndex(x, y, level)) * components);
+					}
+				}
+			}
+
+			texels = std::move(reordered);
+		};
+
+		if (m_Storage == TextureStorage::Float)
+		{
+			reorder(m_FloatPixels, 4);
+		}
+		else if (m_Storage == TextureStorage::Material)
+		{
+			reorder(m_MaterialTexels, 1);
+		}
+		else
+		{
+			reorder(m_Pixels, 1);
+		}
+	}
+
+	const char* Texture::GetName(TextureFilter filter)
+	{
+		switch (filter)
+		{
+		case TextureFilter::Point:
+			return "Point";
+		case TextureFilter::Bilinear:
+			return "Bilinear";
+		default:
+			return "Trilinear";
+		}
+	}
+
+	template<typename Texel>
+	void Texture::GenerateMips(std::vector<Texel>& texels)
+	{
+		constexpr int channels{ sizeof(Texel) };
+
+		m_LevelWidths = { m_Width };
+		m_LevelHeights = { m_Height };
+		m_LevelOffsets = { 0 };
+		m_LevelStrides = { m_Width };
+
+		int width{ m_Width };
+		int height{ m_Height };
+
+		// 2x2 box filter per channel, odd sizes drop their last row or column
+		while (width > 1 || height > 1)
+		{
+			const int sourceOffset = m_LevelOffsets.back();
+			const int nextWidth = std::max(width / 2, 1);
+			const int nextHeight = std::max(height / 2, 1);
+			const int offset = int(texels.size());
+			texels.resize(offset + size_t(nextWidth) * nextHeight);
+
+			for (int y{}; y < nextHeight; ++y)
+			{
+				const int row0 = sourceOffset + std::min(2 * y, height - 1) * width;
+				const int row1 = sourceOffset + std::min(2 * y + 1, height - 1) * width;
+
+				for (int x{}; x < nextWidth; ++x)
+				{
+					const int x0 = std::min(2 * x, width - 1);
+					const int x1 = std::min(2 * x + 1, width - 1);
+					const Texel corners[4]{ texels[row0 + x0], texels[row0 + x1], texels[row1 + x0], texels[row1 + x1] };
+
+					Texel result{};
+					for (int c{}; c < channels; ++c)
+					{
+						Texel sum{ 2 };
+						for (const Texel corner : corners)
+						{
+							sum += (corner >> (c * 8)) & 0xFF;
+						}
+						result |= (sum / 4) << (c * 8);
+					}
+
+					texels[offset + y * nextWidth + x] = result;
+				}
+			}
+
+			width = nextWidth;
+			height = nextHeight;
+			m_LevelWidths.push_back(width);
+			m_LevelHeights.push_back(height);
+			m_LevelOffsets.push_back(offset);
+			m_LevelStrides.push_back(width);
+		}
+
+		// A two texel read at the very last texel stays inside the allocation
+		texels.push_back(0);
+	}
+
+	const char* Texture::GetName(TextureLayout layout)
+	{
+		switch (layout)
+		{
+		case TextureLayout::Tiled:
+			return "Tiled 4x4";
+		case TextureLayout::Morton:
+			return "Morton";
+		default:
+			return "Linear";
+		}
+	}
+
+	void Texture::PrintLayoutReport(const Texture& texture)
+	{
+		constexpr int viewSize{ 256 };
+		constexpr int timedRepeats{ 16 };
+		constexpr int angles[]{ 0, 30, 45, 60, 90 };
+		const int texelBytes = texture.m_Storage == TextureStorage::Float ? 4 * sizeof(float) :
+			texture.m_Storage == TextureStorage::Material ? sizeof(uint64_t) : sizeof(uint32_t);
+		// Compressed textures only come in blocks, a texel costs the read of its whole block
+		const int blockBytes = texture.m_Storage == TextureStorage::BC5 ? 2 * sizeof(uint64_t) : sizeof(uint64_t);
+		const int layoutCount = texture.IsCompressed() || texture.m_IsVirtual ? 1 : int(TextureLayout::End);
+
+		std::cout << "  " << viewSize << "x" << viewSize << " view at one texel per pixel, L1 misses per 1000 pixels / ns per bilinear packet\n";
+		std::cout << "  " << std::setw(10) << "angle";
+		for (const int angle : angles)
+		{
+			std::cout << std::setw(16) << angle;
+		}
+		std::cout << "\n";
+
+		for (int layout{}; layout < layoutCount; ++layout)
+		{
+			Texture swizzled{ texture };
+			swizzled.SetLayout(TextureLayout(layout));
+			std::cout << "  " << std::setw(10) << GetName(swizzled.GetLayout());
+
+			for (const int angle : angles)
+			{
+				// Pixel steps in texture space, the view is centered on the image
+				const float radians = float(angle) * 3.14159265f / 180.f;
+				const Vector2 stepX{ cosf(radians) / texture.m_Width, sinf(radians) / texture.m_Height };
+				const Vector2 stepY{ -sinf(radians) / texture.m_Width, cosf(radians) / texture.m_Height };
+				const auto getUV = [&](float x, float y)
+				{
+					const float offsetX = x - viewSize / 2;
+					const float offsetY = y - viewSize / 2;
+					return Vector2{ 0.5f + stepX.x * offsetX + stepY.x * offsetY, 0.5f + stepX.y * offsetX + stepY.y * offsetY };
+				};
+
+				// Replays the 2x2 footprint of every pixel in raster order through the simulated cache
+				CacheSimulator cache{};
+				for (int py{}; py < viewSize; ++py)
+				{
+					for (int px{}; px < viewSize; ++px)
+					{
+						const Vector2 uv = getUV(float(px), float(py));
+						const int x = int(floorf(uv.x * texture.m_Width - 0.5f));
+						const int y = int(floorf(uv.y * texture.m_Height - 0.5f));
+
+						for (int corner{}; corner < 4; ++corner)
+						{
+							const int texelX = WrapTexel(x + (corner & 1), texture.m_Width);
+							const int texelY = WrapTexel(y + (corner >> 1), texture.m_Height);
+							const uint64_t index = uint64_t(swizzled.GetTexelIndex(texelX, texelY, 0));
+							cache.Access(texture.IsCompressed() ? (index >> 4) * blockBytes : index * texelBytes);
+						}
+					}
+				}
+
+				const SamplerState sampler{ TextureFilter::Bilinear, TextureAddress::Wrap };
+				const __m256 laneOffsets = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+				const __m256 allLanes = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+				__m256 sum = _mm256_setzero_ps();
+
+				const auto sampleView = [&]()
+				{
+					for (int py{}; py < viewSize; ++py)
+					{
+						const Vector2 rowStart = getUV(0.f, float(py));
+
+						for (int px{}; px < viewSize; px += 8)
+						{
+							const __m256 x = _mm256_add_ps(_mm256_set1_ps(float(px)), laneOffsets);
+							const Vector2Packet uv{
+								_mm256_fmadd_ps(x, _mm256_set1_ps(stepX.x), _mm256_set1_ps(rowStart.x)),
+								_mm256_fmadd_ps(x, _mm256_set1_ps(stepX.y), _mm256_set1_ps(rowStart.y)) };
+							sum = _mm256_add_ps(sum, swizzled.SampleLevel(uv, _mm256_setzero_ps(), sampler, allLanes).g);
+						}
+					}
+				};
+
+				// Virtual textures page in what the view reads first, as far as their budget goes
+				if (swizzled.m_IsVirtual)
+				{
+					for (int frame{}; frame < 8; ++frame)
+					{
+						sampleView();
+						swizzled.UpdatePages();
+					}
+				}
+
+				const auto start = std::chrono::steady_clock::now();
+				for (int repeat{}; repeat < timedRepeats; ++repeat)
+				{
+					sampleView();
+				}
+				const auto end = std::chrono::steady_clock::now();
+
+				// Keeps the timed loop from being optimized away
+				volatile float sink = _mm256_cvtss_f32(sum);
+				(void)sink;
+
+				const double packets = double(timedRepeats) * viewSize * viewSize / 8;
+				const double nanoseconds = std::chrono::duration<double, std::nano>(end - start).count() / packets;
+				const std::streamsize precision = std::cout.precision(1);
+				std::cout << std::setw(9) << std::fixed << cache.misses * 1000.0 / (viewSize * viewSize)
+					<< " / " << std::setw(5) << nanoseconds << std::defaultfloat;
+				std::cout.precision(precision);
+			}
+
+			std::cout << "\n";
+		}
+	}
+
+	ColorRGBPacket Texture::Sample(const Vector2Packet& uv, __m256 lod, const SamplerState& sampler, bool decodeSrgb, __m256 mask) const
+	{
+		assert(m_Storage != TextureStorage::Material && "Packed materials are read with SampleMaterial");
+		switch (sampler.address)
+		{
+		case TextureAddress::Clamp:
+			return SampleWith<TextureAddress::Clamp, ColorRGBPacket>(uv, lod, sampler.filter, decodeSrgb, mask);
+		case TextureAddress::Mirror:
+			return SampleWith<TextureAddress::Mirror, ColorRGBPacket>(uv, lod, sampler.filter, decodeSrgb, mask);
+		default:
+			return SampleWith<TextureAddress::Wrap, ColorRGBPacket>(uv, lod, sampler.filter, decodeSrgb, mask);
+		}
+	}
+
+	template<TextureAddress Address, typename Texel>
+	Texel Texture::SampleWith(const Vector2Packet& uv, __m256 lod, TextureFilter filter, bool decodeSrgb, __m256 mask) const
+	{
+		constexpr bool isMaterial = std::is_same_v<Texel, MaterialPacket>;
+		const auto sampleBilinear = [this, &uv](__m256i level, __m256 mask)
+		{
+			if constexpr (isMaterial)
+			{
+				return SampleMaterialBilinear<Address>(uv, level, mask);
+			}
+			else
+			{
+				return SampleBilinear<Address>(uv, level, mask);
+			}
+		};
+
+		// max first so NaN lods land on level 0
+		const __m256 maxLevel = _mm256_set1_ps(float(GetLevelCount() - 1));
+		lod = _mm256_min_ps(_mm256_max_ps(lod, _mm256_setzero_ps()), maxLevel);
+
+		Texel color{};
+
+		if (filter == TextureFilter::Trilinear)
+		{
+			const __m256 levelFloor = _mm256_floor_ps(lod);
+			const __m256 t = _mm256_sub_ps(lod, levelFloor);
+			const __m256i level = _mm256_cvtps_epi32(levelFloor);
+
+			color = sampleBilinear(level, mask);
+
+			// Magnified and exactly on level lanes are done after one level
+			const __m256 blended = _mm256_and_ps(mask, _mm256_cmp_ps(t, _mm256_setzero_ps(), _CMP_GT_OQ));
+			if (_mm256_movemask_ps(blended) != 0)
+			{
+				const __m256i nextLevel = _mm256_min_epi32(_mm256_add_epi32(level, _mm256_set1_epi32(1)), _mm256_set1_epi32(GetLevelCount() - 1));
+				color = Lerp(color, sampleBilinear(nextLevel, blended), t);
+			}
+		}
+		else
+		{
+			// Rounds to the nearest level
+			const __m256i level = _mm256_cvtps_epi32(lod);
+
+			if (filter == TextureFilter::Point)
+			{
+				if constexpr (isMaterial)
+				{
+					return SampleMaterialPoint<Address>(uv, level, mask);
+				}
+				else
+				{
+					return SamplePoint<Address>(uv, level, decodeSrgb, mask);
+				}
+			}
+
+			color = sampleBilinear(level, mask);
+		}
+
+		if constexpr (!isMaterial)
+		{
+			if (decodeSrgb)
+			{
+				return { SrgbToLinear(color.r), SrgbToLinear(color.g), SrgbToLinear(color.b) };
+			}
+		}
+		return color;
+	}
+
+	template<TextureAddress Address>
+	MaterialPacket Texture::SampleMaterialPoint(const Vector2Packet& uv, __m256i level, __m256 mask) const
+	{
+		__m256i low, high;
+		FetchMaterialTexels(GetPointIndices<Address>(uv, level), mask, low, high);
+
+		const __m256 toUnit = _mm256_set1_ps(1.f / 255.f);
+		return {
+			{ _mm256_mul_ps(UnpackByte<0>(low), toUnit), _mm256_mul_ps(UnpackByte<8>(low), toUnit), _mm256_mul_ps(UnpackByte<16>(low), toUnit) },
+			{ _mm256_mul_ps(UnpackByte<24>(low), toUnit), _mm256_mul_ps(UnpackByte<0>(high), toUnit), _mm256_setzero_ps() },
+			_mm256_mul_ps(UnpackByte<8>(high), toUnit),
+			_mm256_mul_ps(UnpackByte<16>(high), toUnit)
+		};
+	}
+
+	template<TextureAddress Address>
+	MaterialPacket Texture::SampleMaterialBilinear(const Vector2Packet& uv, __m256i level, __m256 mask) const
+	{
+		const auto [levels, column0, column1, line0, line1, tx, ty] = GetBilinearFootprint<Address>(uv, level);
+
+		__m256i low00, high00, low10, high10, low01, high01, low11, high11;
+		FetchMaterialTexels(GetTexelIndices(column0, line0, levels), mask, low00, high00);
+		FetchMaterialTexels(GetTexelIndices(column1, line0, levels), mask, low10, high10);
+		FetchMaterialTexels(GetTexelIndices(column0, line1, levels), mask, low01, high01);
+		FetchMaterialTexels(GetTexelIndices(column1, line1, levels), mask, low11, high11);
+
+		const BilinearWeights weights{ tx, ty };
+		return {
+			{ weights.Filter<0>(low00, low10, low01, low11), weights.Filter<8>(low00, low10, low01, low11), weights.Filter<16>(low00, low10, low01, low11) },
+			{ weights.Filter<24>(low00, low10, low01, low11), weights.Filter<0>(high00, high10, high01, high11), _mm256_setzero_ps() },
+			weights.Filter<8>(high00, high10, high01, high11),
+			weights.Filter<16>(high00, high10, high01, high11)
+		};
+	}
+
+	template<TextureAddress Address>
+	__m256i Texture::GetPointIndices(const Vector2Packet& uv, __m256i level) const
+	{
+		const LevelPacket levels = GetLevels(level);
+
+		const __m256i x = AddressTexels<Address>(_mm256_cvtps_epi32(_mm256_floor_ps(_mm256_mul_ps(uv.x, _mm256_cvtepi32_ps(levels.width)))), levels.width, m_IsPowerOfTwo);
+		const __m256i y = AddressTexels<Address>(_mm256_cvtps_epi32(_mm256_floor_ps(_mm256_mul_ps(uv.y, _mm256_cvtepi32_ps(levels.height)))), levels.height, m_IsPowerOfTwo);
+		return GetTexelIndices(x, y, levels);
+	}
+
+	template<TextureAddress Address>
+	Texture::BilinearFootprint Texture::GetBilinearFootprint(const Vector2Packet& uv, __m256i level) const
+	{
+		const LevelPacket levels = GetLevels(level);
+
+		// Texel centers sit at half coordinates
+		const __m256 half = _mm256_set1_ps(0.5f);
+		const __m256 x = _mm256_sub_ps(_mm256_mul_ps(uv.x, _mm256_cvtepi32_ps(levels.width)), half);
+		const __m256 y = _mm256_sub_ps(_mm256_mul_ps(uv.y, _mm256_cvtepi32_ps(levels.height)), half);
+		const __m256 xFloor = _mm256_floor_ps(x);
+		const __m256 yFloor = _mm256_floor_ps(y);
+
+		const __m256i one = _mm256_set1_epi32(1);
+		const __m256i x0 = _mm256_cvtps_epi32(xFloor);
+		const __m256i y0 = _mm256_cvtps_epi32(yFloor);
+
+		return {
+			levels,
+			AddressTexels<Address>(x0, levels.width, m_IsPowerOfTwo),
+			AddressTexels<Address>(_mm256_add_epi32(x0, one), levels.width, m_IsPowerOfTwo),
+			AddressTexels<Address>(y0, levels.height, m_IsPowerOfTwo),
+			AddressTexels<Address>(_mm256_add_epi32(y0, one), levels.height, m_IsPowerOfTwo),
+			_mm256_sub_ps(x, xFloor),
+			_mm256_sub_ps(y, yFloor)
+		};
+	}
+
+	template<TextureAddress Address>
+	ColorRGBPacket Texture::SamplePoint(const Vector2Packet& uv, __m256i level, bool decodeSrgb, __m256 mask) const
+	{
+		const __m256i index = GetPointIndices<Address>(uv, level);
+
+		if (m_Storage == TextureStorage::Float)
+		{
+			const ColorRGBPacket color = FetchTexels(index, mask);
+			return decodeSrgb ? ColorRGBPacket{ SrgbToLinear(color.r), SrgbToLinear(color.g), SrgbToLinear(color.b) } : color;
+		}
+
+		return UnpackRGBA8(GatherPixels(index, mask), decodeSrgb ? g_ByteTables.srgbToLinear.data() : g_ByteTables.unit.data());
+	}
+
+	template<TextureAddress Address>
+	ColorRGBPacket Texture::SampleBilinear(const Vector2Packet& uv, __m256i level, __m256 mask) const
+	{
+		const auto [levels, column0, column1, line0, line1, tx, ty] = GetBilinearFootprint<Address>(uv, level);
+		const __m256i one = _mm256_set1_epi32(1);
+
+		if (m_Storage == TextureStorage::Float)
+		{
+			const ColorRGBPacket top = Lerp(FetchTexels(GetTexelIndices(column0, line0, levels), mask), FetchTexels(GetTexelIndices(column1, line0, levels), mask), tx);
+			const ColorRGBPacket bottom = Lerp(FetchTexels(GetTexelIndices(column0, line1, levels), mask), FetchTexels(GetTexelIndices(column1, line1, levels), mask), tx);
+			return Lerp(top, bottom, ty);
+		}
+
+		if (m_Layout != TextureLayout::Linear)
+		{
+			// Swizzled neighbours are only sometimes next to each other, one read per texel
+			return FilterBilinear(
+				GatherPixels(GetTexelIndices(column0, line0, levels), mask),
+				GatherPixels(GetTexelIndices(column1, line0, levels), mask),
+				GatherPixels(GetTexelIndices(column0, line1, levels), mask),
+				GatherPixels(GetTexelIndices(column1, line1, levels), mask),
+				tx, ty);
+		}
+
+		const int* pPixels = reinterpret_cast<const int*>(GetTexels(m_Pixels));
+		__m256i texel00, texel10, texel01, texel11;
+
+		const __m256i row0 = _mm256_add_epi32(levels.offset, _mm256_mullo_epi32(line0, levels.stride));
+		const __m256i row1 = _mm256_add_epi32(levels.offset, _mm256_mullo_epi32(line1, levels.stride));
+
+		// Both columns of a row come from one 64 bit read at the lower of the two, mirrored tiles just
+		// swap them. Only a wrap seam splits them across the row and needs its own 32 bit reads
+		const __m256i start = _mm256_min_epi32(column0, column1);
+		const __m256i leftIsHigh = _mm256_cmpgt_epi32(column0, start);
+		const __m256i rightIsHigh = _mm256_cmpgt_epi32(column1, start);
+		const __m256i seam = _mm256_and_si256(_mm256_castps_si256(mask),
+			_mm256_cmpgt_epi32(_mm256_abs_epi32(_mm256_sub_epi32(column1, column0)), one));
+		const bool hasSeam = !_mm256_testz_si256(seam, seam);
+
+		const __m256i wideMask = _mm256_castps_si256(mask);
+		const __m256i lowMask = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(wideMask));
+		const __m256i highMask = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(wideMask, 1));
+
+		const auto readRow = [&](__m256i row, __m256i& left, __m256i& right)
+		{
+			const __m256i index = _mm256_add_epi32(row, start);
+			const __m256i low = _mm256_mask_i32gather_epi64(_mm256_setzero_si256(), reinterpret_cast<const long long*>(pPixels),
+				_mm256_castsi256_si128(index), lowMask, sizeof(uint32_t));
+			const __m256i high = _mm256_mask_i32gather_epi64(_mm256_setzero_si256(), reinterpret_cast<const long long*>(pPixels),
+				_mm256_extracti128_si256(index, 1), highMask, sizeof(uint32_t));
+
+			__m256i lower, upper;
+			Deinterleave(low, high, lower, upper);
+
+			left = _mm256_blendv_epi8(lower, upper, leftIsHigh);
+			right = _mm256_blendv_epi8(lower, upper, rightIsHigh);
+
+			if (hasSeam)
+			{
+				left = _mm256_mask_i32gather_epi32(left, pPixels, _mm256_add_epi32(row, column0), seam, sizeof(uint32_t));
+				right = _mm256_mask_i32gather_epi32(right, pPixels, _mm256_add_epi32(row, column1), seam, sizeof(uint32_t));
+			}
+		};
+
+		readRow(row0, texel00, texel10);
+		readRow(row1, texel01, texel11);
+
+		return FilterBilinear(texel00, texel10, texel01, texel11, tx, ty);
+	}
+
+	ColorRGBPacket Texture::FetchTexels(__m256i index, __m256 mask) const
+	{
+		if (m_Storage == TextureStorage::Float)
+		{
+			const __m256i first = _mm256_slli_epi32(index, 2);
+			const __m256 zero = _mm256_setzero_ps();
+			const float* pTexels = GetTexels(m_FloatPixels);
+
+			return {
+				_mm256_mask_i32gather_ps(zero, pTexels, first, mask, sizeof(float)),
+				_mm256_mask_i32gather_ps(zero, pTexels + 1, first, mask, sizeof(float)),
+				_mm256_mask_i32gather_ps(zero, pTexels + 2, first, mask, sizeof(float))
+			};
+		}
+
+		const __m256i pixels = GatherPixels(index, mask);
+
+		// Filtered texels get weighted anyway, a multiply is cheaper than three table gathers
+		const __m256i channelMask = _mm256_set1_epi32(0xFF);
+		const __m256 toUnit = _mm256_set1_ps(1.f / 255.f);
+
+		return {
+			_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(pixels, channelMask)), toUnit),
+			_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(pixels, 8), channelMask)), toUnit),
+			_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(pixels, 16), channelMask)), toUnit)
+		};
+	}
+
+	__m256i Texture::GatherPixels(__m256i index, __m256 mask) const
+	{
+		if (!IsCompressed() && !m_IsVirtual)
+		{
+			return _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), reinterpret_cast<const int*>(GetTexels(m_Pixels)),
+				index, _mm256_castps_si256(mask), sizeof(uint32_t));
+		}
+
+		// Lanes whose block is cached read it with one gather, the rest decode one by one. The gather goes
+		// first since decoding a missed block can evict one another lane hit
+		const __m256i wideMask = _mm256_castps_si256(mask);
+		const __m256i block = _mm256_srli_epi32(index, 4);
+		const __m256i slot = _mm256_srli_epi32(_mm256_mullo_epi32(block, _mm256_set1_epi32(int(BlockHash))), 32 - BlockCacheBits);
+		const __m256i tags = _mm256_mask_i32gather_epi32(_mm256_set1_epi32(-1), m_CachedBlocks.data(), slot, wideMask, sizeof(int));
+		const __m256i hits = _mm256_and_si256(wideMask, _mm256_cmpeq_epi32(tags, block));
+		const __m256i texel = _mm256_add_epi32(_mm256_slli_epi32(slot, 4), _mm256_and_si256(index, _mm256_set1_epi32(15)));
+		const __m256i cached = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), reinterpret_cast<const int*>(m_CachedTexels.data()),
+			texel, hits, sizeof(uint32_t));
+
+		int misses = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_andnot_si256(hits, wideMask)));
+		if (misses == 0)
+		{
+			return cached;
+		}
+
+		alignas(32) int indices[8];
+		alignas(32) uint32_t pixels[8];
+		_mm256_store_si256(reinterpret_cast<__m256i*>(indices), index);
+		_mm256_store_si256(reinterpret_cast<__m256i*>(pixels), cached);
+
+		for (; misses != 0; misses &= misses - 1)
+		{
+			const int lane = std::countr_zero(unsigned(misses));
+			pixels[lane] = ReadBlockTexel(indices[lane]);
+		}
+
+		return _mm256_load_si256(reinterpret_cast<const __m256i*>(pixels));
+	}
+
+	uint32_t Texture::ReadBlockTexel(int index) const
+	{
+		const int block = index >> 4;
+		const size_t slot = (uint32_t(block) * BlockHash) >> (32 - BlockCacheBits);
+		uint32_t* pTexels = &m_CachedTexels[slot * 16];
+
+		if (m_CachedBlocks[slot] != block)
+		{
+			const uint64_t* pBlock = FindBlock(block);
+			if (!pBlock)
+			{
+				// Same spot one level coarser. Cached under its own block, this one is decoded once its page is in
+				int level, blockX, blockY;
+				LocateBlock(block, level, blockX, blockY);
+				const int x = std::min((blockX * 4 + (index & 3)) >> 1, m_LevelWidths[level + 1] - 1);
+				const int y = std::min((blockY * 4 + ((index >> 2) & 3)) >> 1, m_LevelHeights[level + 1] - 1);
+				return ReadBlockTexel(GetTexelIndex(x, y, level + 1));
+			}
+
+			m_CachedBlocks[slot] = block;
+
+			if (m_Storage == TextureStorage::RGBA8)
+			{
+				memcpy(pTexels, pBlock, 16 * sizeof(uint32_t));
+			}
+			else if (m_Storage == TextureStorage::BC1)
+			{
+				const uint64_t bits = pBlock[0];
+				const std::array<uint32_t, 4> palette = GetBC1Palette(uint16_t(bits), uint16_t(bits >> 16));
+				for (int i{}; i < 16; ++i)
+				{
+					pTexels[i] = palette[(bits >> (32 + 2 * i)) & 3];
+				}
+			}
+			else if (m_Storage == TextureStorage::BC4)
+			{
+				const std::array<uint8_t, 16> values = DecodeBC4(pBlock[0]);
+				for (int i{}; i < 16; ++i)
+				{
+					pTexels[i] = 0xFF000000 | values[i] * 0x010101u;
+				}
+			}
+			else
+			{
+				const std::array<uint8_t, 16> x = DecodeBC4(pBlock[0]);
+				const std::array<uint8_t, 16> y = DecodeBC4(pBlock[1]);
+				for (int i{}; i < 16; ++i)
+				{
+					// Unit length rebuilds z from the [-1, 1] x and y
+					const float normalX = x[i] / 127.5f - 1.f;
+					const float normalY = y[i] / 127.5f - 1.f;
+					const float normalZ = sqrtf(std::max(1.f - normalX * normalX - normalY * normalY, 0.f));
+					pTexels[i] = 0xFF000000 | uint32_t((normalZ + 1.f) * 127.5f + 0.5f) << 16 | uint32_t(y[i]) << 8 | x[i];
+				}
+			}
+		}
+
+		return pTexels[index & 15];
+	}
+
+	uint64_t Texture::ReadMaterialTexel(int index) const
+	{
+		const int block = index >> 4;
+		const size_t slot = (uint32_t(block) * BlockHash) >> (32 - BlockCacheBits);
+		uint64_t* pTexels = &m_CachedMaterialTexels[slot * 16];
+
+		if (m_CachedBlocks[slot] != block)
+		{
+			const uint64_t* pBlock = FindBlock(block);
+			if (!pBlock)
+			{
+				// Same spot one level coarser, as for the other storages
+				int level, blockX, blockY;
+				LocateBlock(block, level, blockX, blockY);
+				const int x = std::min((blockX * 4 + (index & 3)) >> 1, m_LevelWidths[level + 1] - 1);
+				const int y = std::min((blockY * 4 + ((index >> 2) & 3)) >> 1, m_LevelHeights[level + 1] - 1);
+				return ReadMaterialTexel(GetTexelIndex(x, y, level + 1));
+			}
+
+			m_CachedBlocks[slot] = block;
+			std::copy_n(pBlock, 16, pTexels);
+		}
+
+		return pTexels[index & 15];
+	}
+
+	const uint64_t* Texture::FindBlock(int block) const
+	{
+		if (!m_IsVirtual)
+		{
+			return GetTexels(m_Blocks) + size_t(block) * m_BlockWords;
+		}
+
+		int level, blockX, blockY;
+		LocateBlock(block, level, blockX, blockY);
+		const int page = m_LevelPageOffsets[level] + (blockY >> PageBlockBits) * m_LevelPagesPerRow[level] + (blockX >> PageBlockBits);
+		const int slot = m_PageTable[page];
+
+		// Reads are the feedback, a missing page is asked for and a resident one marked as used
+		if (slot < 0)
+		{
+			m_PageRequests[page] = m_Frame;
+			return nullptr;
+		}
+
+		if (m_SlotLastUse[slot] != UINT32_MAX)
+		{
+			m_SlotLastUse[slot] = m_Frame;
+		}
+
+		const int pageMask = (1 << PageBlockBits) - 1;
+		const size_t pageBlock = (size_t(slot) << (2 * PageBlockBits)) + ((blockY & pageMask) << PageBlockBits) + (blockX & pageMask);
+		return &m_SlotBlocks[pageBlock * m_BlockWords];
+	}
+
+	void Texture::LocateBlock(int block, int& level, int& blockX, int& blockY) const
+	{
+		// Level offsets are in texels and ascending
+		level = int(std::upper_bound(m_LevelOffsets.begin(), m_LevelOffsets.end(), block * 16) - m_LevelOffsets.begin()) - 1;
+		const int local = block - m_LevelOffsets[level] / 16;
+		blockX = local % m_LevelStrides[level];
+		blockY = local / m_LevelStrides[level];
+	}
+
+	__m256 Texture::GetLod(const Vector2Packet& ddx, const Vector2Packet& ddy) const
+	{
+		// Footprint of one pixel in level 0 texels, the longer of its two axes picks the level
+		const __m256 width = _mm256_set1_ps(float(m_Width));
+		const __m256 height = _mm256_set1_ps(float(m_Height));
+		const __m256 dxu = _mm256_mul_ps(ddx.x, width);
+		const __m256 dxv = _mm256_mul_ps(ddx.y, height);
+		const __m256 dyu = _mm256_mul_ps(ddy.x, width);
+		const __m256 dyv = _mm256_mul_ps(ddy.y, height);
+		const __m256 lengthSquared = _mm256_max_ps(
+			_mm256_fmadd_ps(dxu, dxu, _mm256_mul_ps(dxv, dxv)),
+			_mm256_fmadd_ps(dyu, dyu, _mm256_mul_ps(dyv, dyv)));
+
+		// log2 straight from the float bits, within 0.09 of a level, halved for the square
+		const __m256 bits = _mm256_cvtepi32_ps(_mm256_castps_si256(_mm256_max_ps(lengthSquared, _mm256_set1_ps(FLT_MIN))));
+		const __m256 log2 = _mm256_fmsub_ps(bits, _mm256_set1_ps(1.f / (1 << 23)), _mm256_set1_ps(127.f));
+		return _mm256_mul_ps(log2, _mm256_set1_ps(0.5f));
+	}
+
+	void Texture::FetchMaterialTexels(__m256i index, __m256 mask, __m256i& low, __m256i& high) const
+	{
+		const __m256i wideMask = _mm256_castps_si256(mask);
+		const __m256i zero = _mm256_setzero_si256();
+
+		if (!m_IsVirtual)
+		{
+			const long long* pTexels = reinterpret_cast<const long long*>(GetTexels(m_MaterialTexels));
+			const __m256i first = _mm256_mask_i32gather_epi64(zero, pTexels, _mm256_castsi256_si128(index),
+				_mm256_cvtepi32_epi64(_mm256_castsi256_si128(wideMask)), sizeof(uint64_t));
+			const __m256i second = _mm256_mask_i32gather_epi64(zero, pTexels, _mm256_extracti128_si256(index, 1),
+				_mm256_cvtepi32_epi64(_mm256_extracti128_si256(wideMask, 1)), sizeof(uint64_t));
+
+			Deinterleave(first, second, low, high);
+			return;
+		}
+
+		// As GatherPixels: cached blocks with one gather per half, the misses one by one
+		const __m256i block = _mm256_srli_epi32(index, 4);
+		const __m256i slot = _mm256_srli_epi32(_mm256_mullo_epi32(block, _mm256_set1_epi32(int(BlockHash))), 32 - BlockCacheBits);
+		const __m256i tags = _mm256_mask_i32gather_epi32(_mm256_set1_epi32(-1), m_CachedBlocks.data(), slot, wideMask, sizeof(int));
+		const __m256i hits = _mm256_and_si256(wideMask, _mm256_cmpeq_epi32(tags, block));
+		const __m256i texel = _mm256_add_epi32(_mm256_slli_epi32(slot, 4), _mm256_and_si256(index, _mm256_set1_epi32(15)));
+		const long long* pCached = reinterpret_cast<const long long*>(m_CachedMaterialTexels.data());
+		__m256i first = _mm256_mask_i32gather_epi64(zero, pCached, _mm256_castsi256_si128(texel),
+			_mm256_cvtepi32_epi64(_mm256_castsi256_si128(hits)), sizeof(uint64_t));
+		__m256i second = _mm256_mask_i32gather_epi64(zero, pCached, _mm256_extracti128_si256(texel, 1),
+			_mm256_cvtepi32_epi64(_mm256_extracti128_si256(hits, 1)), sizeof(uint64_t));
+
+		int misses = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_andnot_si256(hits, wideMask)));
+		if (misses != 0)
+		{
+			alignas(32) int indices[8];
+			alignas(32) uint64_t texels[8];
+			_mm256_store_si256(reinterpret_cast<__m256i*>(indices), index);
+			_mm256_store_si256(reinterpret_cast<__m256i*>(texels), first);
+			_mm256_store_si256(reinterpret_cast<__m256i*>(texels + 4), second);
+
+			for (; misses != 0; misses &= misses - 1)
+			{
+				const int lane = std::countr_zero(unsigned(misses));
+				texels[lane] = ReadMaterialTexel(indices[lane]);
+			}
+
+			first = _mm256_load_si256(reinterpret_cast<const __m256i*>(texels));
+			second = _mm256_load_si256(reinterpret_cast<const __m256i*>(texels + 4));
+		}
+
+		Deinterleave(first, second, low, high);
+	}
+
+	size_t Texture::LayOutLevels()
+	{
+		size_t texelCount{};
+
+		for (int level{}; level < GetLevelCount(); ++level)
+		{
+			const int width = m_LevelWidths[level];
+			const int height = m_LevelHeights[level];
+			m_LevelOffsets[level] = int(texelCount);
+
+			switch (m_Layout)
+			{
+			case TextureLayout::Tiled:
+				// Partial blocks at the right and bottom edge are padded
+				m_LevelStrides[level] = (width + 3) / 4;
+				texelCount += size_t(m_LevelStrides[level]) * ((height + 3) / 4) * 16;
+				break;
+			case TextureLayout::Morton:
+				// A non square level is a row or column of square Z order blocks
+				m_LevelStrides[level] = std::countr_zero(unsigned(std::min(width, height)));
+				texelCount += size_t(width) * height;
+				break;
+			default:
+				m_LevelStrides[level] = width;
+				texelCount += size_t(width) * height;
+				break;
+			}
+		}
+
+		return texelCount;
+	}
+
+	int Texture::GetTexelIndex(int x, int y, int level) const
+	{
+		const int offset = m_LevelOffsets[level];
+		const int stride = m_LevelStrides[level];
+
+		switch (m_Layout)
+		{
+		case TextureLayout::Tiled:
+			return offset + (((y >> 2) * stride + (x >> 2)) << 4) + ((y & 3) << 2) + (x & 3);
+		case TextureLayout::Morton:
+		{
+			const int blockMask = (1 << stride) - 1;
+			const int block = (x >> stride) + (y >> stride);
+			return offset + (block << (2 * stride)) + int(SpreadBits(uint32_t(x & blockMask)) | (SpreadBits(uint32_t(y & blockMask)) << 1));
+		}
+		default:
+			return offset + y * stride + x;
+		}
+	}
+
+	__m256i Texture::GetTexelIndices(__m256i x, __m256i y, const LevelPacket& level) const
+	{
+		switch (m_Layout)
+		{
+		case TextureLayout::Tiled:
+		{
+			const __m256i three = _mm256_set1_epi32(3);
+			const __m256i block = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(y, 2), level.stride), _mm256_srli_epi32(x, 2));
+			const __m256i inBlock = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(y, three), 2), _mm256_and_si256(x, three));
+			return _mm256_add_epi32(level.offset, _mm256_add_epi32(_mm256_slli_epi32(block, 4), inBlock));
+		}
+		case TextureLayout::Morton:
+		{
+			const __m256i blockMask = _mm256_sub_epi32(_mm256_sllv_epi32(_mm256_set1_epi32(1), level.stride), _mm256_set1_epi32(1));
+			const __m256i block = _mm256_add_epi32(_mm256_srlv_epi32(x, level.stride), _mm256_srlv_epi32(y, level.stride));
+			const __m256i inBlock = _mm256_or_si256(SpreadBits(_mm256_and_si256(x, blockMask)), _mm256_slli_epi32(SpreadBits(_mm256_and_si256(y, blockMask)), 1));
+			return _mm256_add_epi32(level.offset, _mm256_add_epi32(_mm256_sllv_epi32(block, _mm256_add_epi32(level.stride, level.stride)), inBlock));
+		}
+		default:
+			return _mm256_add_epi32(level.offset, _mm256_add_epi32(_mm256_mullo_epi32(y, level.stride), x));
+		}
+	}
+
+	Texture::LevelPacket Texture::GetLevels(__m256i level) const
+	{
+		return {
+			_mm256_i32gather_epi32(m_LevelWidths.data(), level, sizeof(int)),
+			_mm256_i32gather_epi32(m_LevelHeights.data(), level, sizeof(int)),
+			_mm256_i32gather_epi32(m_LevelOffsets.data(), level, sizeof(int)),
+			_mm256_i32gather_epi32(m_LevelStrides.data(), level, sizeof(int))
+		};
 	}
-}
\ No newline at end of file
+}
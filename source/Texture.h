@@ -1,24 +1,269 @@
 #pragma once
-#include <SDL_surface.h>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
 #include <string>
+#include <vector>
 #include "ColorRGB.h"
+#include "Packet.h"
 
 namespace dae
 {
 	struct Vector2;
+	class MappedFile;
+
+	// How a texture keeps its texels after loading, the SDL surface is not kept around
+	enum class TextureStorage
+	{
+		// 4 bytes per texel, R in the lowest byte
+		RGBA8,
+		// 4 floats per texel already divided by 255, 4 times the memory but no unpacking
+		Float,
+		// 8 bytes per texel: diffuse RGB, normal XY, gloss, specular and a spare byte. Built by PackMaterial
+		Material,
+		// Block compressed, 4x4 texels per block, decoded back to RGBA8 when sampled
+		// 8 bytes per block: two 565 endpoints and 2 bit indices, for color maps
+		BC1,
+		// 8 bytes per block: one channel with two 8 bit endpoints and 3 bit indices, for single channel maps
+		BC4,
+		// 16 bytes per block: two BC4 blocks for X and Y, for normal maps. Z is rebuilt on decode
+		BC5
+	};
+
+	// Order of the texels inside each mip level
+	enum class TextureLayout
+	{
+		// Row by row as loaded
+		Linear,
+		// 4x4 blocks, one 64 byte cache line of RGBA8 texels each, the blocks row by row
+		Tiled,
+		// Z order curve, power of two textures only. Others fall back to Tiled
+		Morton,
+		End
+	};
+
+	enum class TextureFilter
+	{
+		// Nearest texel of the nearest mip level
+		Point,
+		// 2x2 texels of the nearest mip level
+		Bilinear,
+		// Bilinear in the two nearest mip levels, blended by the lod
+		Trilinear,
+		End
+	};
+
+	// What UVs outside [0, 1) read, the same for both axes
+	enum class TextureAddress
+	{
+		Wrap,
+		Clamp,
+		Mirror
+	};
+
+	struct SamplerState
+	{
+		TextureFilter filter{ TextureFilter::Trilinear };
+		TextureAddress address{ TextureAddress::Wrap };
+	};
+
+	// Every map of a material for 8 fragments, from one fetch of a packed material texture
+	struct MaterialPacket
+	{
+		ColorRGBPacket diffuse{};
+		// Tangent space, z rebuilt from x and y
+		Vector3Packet normal{};
+		// Already scaled by the material's shine
+		__m256 gloss{};
+		__m256 specular{};
+	};
 
 	class Texture
 	{
 	public:
-		~Texture();
+		// The first load writes the finished levels to a cache file next to the source, keyed by the source's
+		// bytes and the storage and layout. Later loads map that file and sample straight from it. Null when the
+		// source can't be decoded
+		static Texture* LoadFromFile(const std::string& path, TextureStorage storage = TextureStorage::RGBA8, TextureLayout layout = TextureLayout::Linear);
+		// Interleaves the maps of a material into one texel record so shading reads them all with one fetch.
+		// The size follows the diffuse map and the specular color is reduced to its mean. When all four maps
+		// came from files the result is cached next to the diffuse map, keyed by their sources and the shine
+		static Texture* PackMaterial(const Texture& diffuse, const Texture& normal, const Texture& gloss, const Texture& specular, float shine);
+		// A single texel of one color, for materials to sample while their maps are still loading
+		static Texture* CreateSolid(const ColorRGB& color);
 
-		static Texture* LoadFromFile(const std::string& path);
+		// Point sampled from the full image, wrapped. Packed materials return their diffuse color
 		ColorRGB Sample(const Vector2& uv) const;
 
+		// Filtered read at a per lane lod, 0 is the full image. Lanes outside the mask are not read and come back black
+		ColorRGBPacket SampleLevel(const Vector2Packet& uv, __m256 lod, const SamplerState& sampler, __m256 mask) const;
+		// SampleLevel with the lod from the screen space derivatives of the UVs, zero derivatives read the full image
+		ColorRGBPacket SampleGrad(const Vector2Packet& uv, const Vector2Packet& ddx, const Vector2Packet& ddy, const SamplerState& sampler, __m256 mask) const;
+		// SampleGrad for sRGB encoded images, filtered in sRGB and decoded after
+		ColorRGBPacket SampleGradLinear(const Vector2Packet& uv, const Vector2Packet& ddx, const Vector2Packet& ddy, const SamplerState& sampler, __m256 mask) const;
+		// The only way to read a packed material, decodeSrgb applies to the diffuse color
+		MaterialPacket SampleMaterial(const Vector2Packet& uv, const Vector2Packet& ddx, const Vector2Packet& ddy, const SamplerState& sampler, bool decodeSrgb, __m256 mask) const;
+
+		int GetLevelCount() const { return int(m_LevelWidths.size()); }
+
+		// Encodes every level of an RGBA8 texture into one of the block formats, in place
+		void Compress(TextureStorage format);
+		bool IsCompressed() const;
+		// Moves every level of an RGBA8, packed material or block compressed texture out to a page file of 128x128
+		// texel pages and keeps at most pageBudget of them in memory, the single page levels always. Pages missing
+		// when sampled read the next coarser level instead and get asked for. A texture mapped from a tiled cache
+		// file pages straight from the mapping, anything else is written to a temporary page file first
+		void MakeVirtual(int pageBudget);
+		// Loads the pages asked for since the last call, coarse levels first, over the least recently used
+		// ones. Once per frame, does nothing for textures that aren't virtual
+		void UpdatePages();
+		// Bytes held in memory by the texels of every level, or by the resident pages
+		size_t GetMemorySize() const;
+
+		// Reorders the texels of every level in place. Compressed textures stay in their 4x4 blocks
+		void SetLayout(TextureLayout layout);
+		TextureLayout GetLayout() const { return m_Layout; }
+
+		static const char* GetName(TextureFilter filter);
+		static const char* GetName(TextureLayout layout);
+		// Simulated L1 misses and measured bilinear sample time of each layout, for views rotated across the image
+		static void PrintLayoutReport(const Texture& texture);
+
 	private:
-		Texture(SDL_Surface* pSurface);
+		Texture(int width, int height, TextureStorage storage);
+
+		int m_Width{};
+		int m_Height{};
+		TextureStorage m_Storage{};
+		TextureLayout m_Layout{};
+		// Every level is then a power of two as well and addressing is a mask
+		bool m_IsPowerOfTwo{};
+
+		// Every mip level back to back, level 0 first, plus one spare texel at the end
+		std::vector<uint32_t> m_Pixels{};
+		std::vector<float> m_FloatPixels{};
+		std::vector<uint64_t> m_MaterialTexels{};
+		float m_GlossScale{ 1.f };
+		// Set when the texels of the storage are read from a mapped cache file instead of their vector.
+		// Anything that changes them copies them out first
+		std::shared_ptr<const MappedFile> m_pMapping{};
+		size_t m_MappedTexelOffset{};
+		// The file the texture was loaded from and its hash, textures built from it cache under those
+		std::string m_SourcePath{};
+		uint64_t m_SourceHash{};
+		// Compressed blocks in the order of the Tiled layout, so a texel index over 16 is its block
+		std::vector<uint64_t> m_Blocks{};
+
+		// Recently decoded blocks, direct mapped by a hash of the block index. 64 KB of RGBA8 texels, about
+		// a screen wide band of blocks. Only safe while a single thread samples the texture, which the renderer does
+		static constexpr int BlockCacheBits{ 10 };
+		// Fibonacci hashing spreads neighbouring blocks over the whole cache
+		static constexpr uint32_t BlockHash{ 2654435761u };
+		mutable std::vector<int> m_CachedBlocks{};
+		mutable std::vector<uint32_t> m_CachedTexels{};
+		// The same for a virtual packed material, 128 KB
+		mutable std::vector<uint64_t> m_CachedMaterialTexels{};
+		// 64 bit words per 4x4 block: 8 for RGBA8, 16 for a packed material, 1 for BC1 and BC4, 2 for BC5
+		int m_BlockWords{ 8 };
+
+		// Virtual textures: 32x32 blocks per page, the blocks row by row. Every level starts a new row of pages
+		static constexpr int PageBlockBits{ 5 };
+		// Pages loaded per UpdatePages call
+		static constexpr int MaxPageLoads{ 16 };
+		bool m_IsVirtual{};
+		std::shared_ptr<FILE> m_pPageFile{};
+		std::vector<int> m_LevelPageOffsets{};
+		std::vector<int> m_LevelPagesPerRow{};
+		uint32_t m_Frame{ 1 };
+		// Page to slot, -1 while the page isn't resident, and the frame a missing page was last asked for
+		mutable std::vector<int> m_PageTable{};
+		mutable std::vector<uint32_t> m_PageRequests{};
+		// Slot to page and the frame the slot was last read, pinned slots are never evicted
+		std::vector<int> m_SlotPages{};
+		mutable std::vector<uint32_t> m_SlotLastUse{};
+		// Grows to the budget as slots are first used
+		std::vector<uint64_t> m_SlotBlocks{};
+
+		// Per level, as int so they can be gathered per lane
+		std::vector<int> m_LevelWidths{};
+		std::vector<int> m_LevelHeights{};
+		std::vector<int> m_LevelOffsets{};
+		// Linear: texels per row, Tiled: blocks per row, Morton: log2 of the shorter side
+		std::vector<int> m_LevelStrides{};
+
+		// The level parameters of every lane
+		struct LevelPacket
+		{
+			__m256i width;
+			__m256i height;
+			__m256i offset;
+			__m256i stride;
+		};
+
+		// Bump whenever the cache file layout or anything that produces the cached texels changes
+		static constexpr uint32_t CacheVersion{ 1 };
+		static Texture* LoadFromCache(const std::string& cachePath, uint64_t sourceHash, TextureStorage storage);
+		void WriteCache(const std::string& cachePath, uint64_t sourceHash) const;
+
+		template<typename Texel>
+		const Texel* GetTexels(const std::vector<Texel>& texels) const;
+		void Unmap();
+		void InitBlockCache();
+
+		// Box filters every byte of a texel word
+		template<typename Texel>
+		void GenerateMips(std::vector<Texel>& texels);
+		// Strides and offsets of every level for the current layout, returns the texel count of all levels
+		size_t LayOutLevels();
+
+		int GetTexelIndex(int x, int y, int level) const;
+		__m256i GetTexelIndices(__m256i x, __m256i y, const LevelPacket& level) const;
+		LevelPacket GetLevels(__m256i level) const;
+
+		ColorRGBPacket Sample(const Vector2Packet& uv, __m256 lod, const SamplerState& sampler, bool decodeSrgb, __m256 mask) const;
+		template<TextureAddress Address, typename Texel>
+		Texel SampleWith(const Vector2Packet& uv, __m256 lod, TextureFilter filter, bool decodeSrgb, __m256 mask) const;
+		// Addressed texel coordinates of a 2x2 footprint and the blend weights between them
+		struct BilinearFootprint
+		{
+			LevelPacket levels;
+			__m256i column0;
+			__m256i column1;
+			__m256i line0;
+			__m256i line1;
+			__m256 tx;
+			__m256 ty;
+		};
+
+		template<TextureAddress Address>
+		__m256i GetPointIndices(const Vector2Packet& uv, __m256i level) const;
+		template<TextureAddress Address>
+		BilinearFootprint GetBilinearFootprint(const Vector2Packet& uv, __m256i level) const;
+
+		template<TextureAddress Address>
+		ColorRGBPacket SamplePoint(const Vector2Packet& uv, __m256i level, bool decodeSrgb, __m256 mask) const;
+		template<TextureAddress Address>
+		ColorRGBPacket SampleBilinear(const Vector2Packet& uv, __m256i level, __m256 mask) const;
+		// Unit range channels, the normal still in [0, 1] and without z
+		template<TextureAddress Address>
+		MaterialPacket SampleMaterialPoint(const Vector2Packet& uv, __m256i level, __m256 mask) const;
+		template<TextureAddress Address>
+		MaterialPacket SampleMaterialBilinear(const Vector2Packet& uv, __m256i level, __m256 mask) const;
 
-		SDL_Surface* m_pSurface{ nullptr };
-		uint32_t* m_pSurfacePixels{ nullptr };
+		ColorRGBPacket FetchTexels(__m256i index, __m256 mask) const;
+		// RGBA8 texels of 8 lanes, gathered or decoded from blocks
+		__m256i GatherPixels(__m256i index, __m256 mask) const;
+		uint32_t ReadBlockTexel(int index) const;
+		uint64_t ReadMaterialTexel(int index) const;
+		// The block's words, nullptr when it sits in a virtual page that isn't resident
+		const uint64_t* FindBlock(int block) const;
+		void LocateBlock(int block, int& level, int& blockX, int& blockY) const;
+		void LoadPage(int page, int slot);
+		void LocatePage(int page, int& level, int& pageX, int& pageY) const;
+		// One page of blocks out of the tiled texels, zero past the edges of the level
+		void CopyPage(int level, int pageX, int pageY, uint64_t* pTarget) const;
+		// Low and high 32 bits of 8 material texels
+		void FetchMaterialTexels(__m256i index, __m256 mask, __m256i& low, __m256i& high) const;
+		__m256 GetLod(const Vector2Packet& ddx, const Vector2Packet& ddy) const;
 	};
-}
\ No newline at end of file
+}
@@ -0,0 +1,54 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+namespace dae
+{
+	ThreadPool::ThreadPool(unsigned int threadCount)
+	{
+		// hardware_concurrency is 0 when it can't tell
+		threadCount = std::max(threadCount, 1u);
+		m_Threads.reserve(threadCount);
+
+		for (unsigned int i{}; i < threadCount; ++i)
+		{
+			m_Threads.emplace_back(&ThreadPool::Work, this);
+		}
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			const std::lock_guard lock{ m_Mutex };
+			m_Stopping = true;
+		}
+
+		m_TaskAdded.notify_all();
+		for (std::thread& thread : m_Threads)
+		{
+			thread.join();
+		}
+	}
+
+	void ThreadPool::Work()
+	{
+		while (true)
+		{
+			std::function<void()> task{};
+
+			{
+				std::unique_lock lock{ m_Mutex };
+				m_TaskAdded.wait(lock, [this] { return m_Stopping || !m_Tasks.empty(); });
+
+				if (m_Tasks.empty())
+				{
+					return;
+				}
+
+				task = std::move(m_Tasks.front());
+				m_Tasks.pop_front();
+			}
+
+			task();
+		}
+	}
+}
@@ -0,0 +1,144 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace dae
+{
+	// Fixed set of worker threads taking tasks first in first out. A task may wait on the future of a
+	// task submitted before it: that one already left the queue, so the wait can't starve the pool
+	class ThreadPool final
+	{
+	public:
+		// One worker per hardware thread by default
+		explicit ThreadPool(unsigned int threadCount = std::thread::hardware_concurrency());
+		// Runs whatever is still queued before joining
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		template<typename Task>
+		std::future<std::invoke_result_t<Task>> Submit(Task&& task);
+
+		// Calls body(i) for every i in [0, count) on the workers and the calling thread, in no particular
+		// order, and returns once all calls are done. The caller takes indices as well, so a task of this
+		// pool may call it without waiting on helpers that are still queued behind it
+		// The first exception body throws is rethrown here once no thread runs body any more, indices not
+		// started by then are skipped
+		template<typename Body>
+		void ParallelFor(size_t count, const Body& body);
+
+		unsigned int GetThreadCount() const { return unsigned(m_Threads.size()); }
+
+	private:
+		std::vector<std::thread> m_Threads{};
+		std::deque<std::function<void()>> m_Tasks{};
+		std::mutex m_Mutex{};
+		std::condition_variable m_TaskAdded{};
+		bool m_Stopping{};
+
+		void Work();
+	};
+
+	template<typename Task>
+	std::future<std::invoke_result_t<Task>> ThreadPool::Submit(Task&& task)
+	{
+		// std::function needs a copyable target, the packaged task is shared instead
+		auto pTask = std::make_shared<std::packaged_task<std::invoke_result_t<Task>()>>(std::forward<Task>(task));
+		std::future<std::invoke_result_t<Task>> result = pTask->get_future();
+
+		{
+			const std::lock_guard lock{ m_Mutex };
+			m_Tasks.emplace_back([pTask] { (*pTask)(); });
+		}
+
+		m_TaskAdded.notify_one();
+		return result;
+	}
+
+	template<typename Body>
+	void ThreadPool::ParallelFor(size_t count, const Body& body)
+	{
+		struct Progress
+		{
+			std::atomic<size_t> next{};
+			std::atomic<bool> failed{};
+			size_t done{};
+			std::exception_ptr pError{};
+			std::mutex mutex{};
+			std::condition_variable finished{};
+		};
+
+		// Helpers that only start once every index is taken return without touching the body
+		const auto pProgress = std::make_shared<Progress>();
+		const auto run = [pProgress, count, &body]
+		{
+			size_t doneCount{};
+			std::exception_ptr pError{};
+			for (size_t i = pProgress->next++; i < count; i = pProgress->next++)
+			{
+				// A thrown index still counts as done, so the caller always gets to return. After the
+				// first failure the remaining indices are only counted
+				if (!pProgress->failed)
+				{
+					try
+					{
+						body(i);
+					}
+					catch (...)
+					{
+						pProgress->failed = true;
+						if (!pError)
+						{
+							pError = std::current_exception();
+						}
+					}
+				}
+				++doneCount;
+			}
+
+			if (doneCount > 0)
+			{
+				const std::lock_guard lock{ pProgress->mutex };
+				if (pError && !pProgress->pError)
+				{
+					pProgress->pError = pError;
+				}
+
+				pProgress->done += doneCount;
+				if (pProgress->done == count)
+				{
+					pProgress->finished.notify_all();
+				}
+			}
+		};
+
+		// The calling thread is one of the hands
+		const size_t helperCount = count > 0 ? std::min(size_t(GetThreadCount()), count) - 1 : 0;
+		for (size_t i{}; i < helperCount; ++i)
+		{
+			Submit(run);
+		}
+
+		run();
+
+		// Helpers still hold a reference to body until every index is done, even when one of them threw
+		std::unique_lock lock{ pProgress->mutex };
+		pProgress->finished.wait(lock, [&] { return pProgress->done == count; });
+
+		if (pProgress->pError)
+		{
+			std::rethrow_exception(pProgress->pError);
+		}
+	}
+}
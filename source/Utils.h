@@ -1,8 +1,13 @@
 #pragma once
+#include <algorithm>
 #include <cassert>
-#include <fstream>
+#include <charconv>
+#include <cstring>
+#include <string_view>
 #include "Math.h"
 #include "DataTypes.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
 
 // #define DISABLE_OBJ
 
@@ -10,167 +15,320 @@ namespace dae
 {
 	namespace Utils
 	{
-		//Just parses vertices and indices
 #pragma warning(push)
 #pragma warning(disable : 4505) //Warning unreferenced local function
-		static bool ParseOBJ(const std::string& filename, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, bool flipAxisAndWinding = true)
+		// One line aligned slice of an OBJ file and what it declares. Faces keep the file's 1-based indices,
+		// which count from the start of the file, so they need no fixing up when the slices are merged
+		struct OBJChunk
 		{
-#ifdef DISABLE_OBJ
+			const char* pBegin{};
+			const char* pEnd{};
 
-			//TODO: Enable the code below after uncommenting all the vertex attributes of DataTypes::Vertex
-			// >> Comment/Remove '#define DISABLE_OBJ'
-			assert(false && "OBJ PARSER not enabled! Check the comments in Utils::ParseOBJ");
+			std::vector<Vector3> positions{};
+			std::vector<Vector2> UVs{};
+			std::vector<Vector3> normals{};
+			// 3 per face, a 0 uv or normal where the corner leaves it out
+			std::vector<uint32_t> cornerPositions{};
+			std::vector<uint32_t> cornerUVs{};
+			std::vector<uint32_t> cornerNormals{};
 
-#else
+			// Where the chunk's elements start in the merged arrays
+			size_t positionOffset{};
+			size_t UVOffset{};
+			size_t normalOffset{};
+			size_t faceOffset{};
+		};
 
-			std::ifstream file(filename);
-			if (!file)
-				return false;
+		// Bytes below which a file isn't worth splitting further
+		constexpr size_t MinOBJChunkSize{ 256 * 1024 };
+		// Chunks per thread, so threads that finish early pick up the rest
+		constexpr size_t OBJChunksPerThread{ 4 };
 
-			std::vector<Vector3> positions{};
-			std::vector<Vector3> normals{};
-			std::vector<Vector2> UVs{};
+		// Scans the chunk's lines in place and reads the numbers with from_chars, which skips the locale
+		// and the per character stream calls
+		static void ParseOBJChunk(OBJChunk& chunk)
+		{
+			const char* pCursor = chunk.pBegin;
+			const char* pLineEnd{};
 
-			vertices.clear();
-			indices.clear();
+			const auto isBlank = [](char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f'; };
+			const auto skipBlanks = [&]()
+			{
+				while (pCursor < pLineEnd && isBlank(*pCursor))
+					++pCursor;
+			};
+			const auto readFloat = [&]()
+			{
+				skipBlanks();
+				if (pCursor < pLineEnd && *pCursor == '+')
+					++pCursor;
 
-			std::string sCommand;
-			// start a while iteration ending when the end of file is reached (ios::eof)
-			while (!file.eof())
+				float value{};
+				pCursor = std::from_chars(pCursor, pLineEnd, value).ptr;
+				return value;
+			};
+			const auto readIndex = [&]()
 			{
-				//read the first word of the string, use the >> operator (istream::operator>>) 
-				file >> sCommand;
-				//use conditional statements to process the different commands	
-				if (sCommand == "#")
-				{
-					// Ignore Comment
-				}
-				else if (sCommand == "v")
+				skipBlanks();
+				uint32_t value{};
+				pCursor = std::from_chars(pCursor, pLineEnd, value).ptr;
+				return value;
+			};
+			const auto peek = [&]() { return pCursor < pLineEnd ? *pCursor : '\0'; };
+
+			while (pCursor < chunk.pEnd)
+			{
+				pLineEnd = static_cast<const char*>(memchr(pCursor, '\n', size_t(chunk.pEnd - pCursor)));
+				if (!pLineEnd)
+					pLineEnd = chunk.pEnd;
+
+				//read the first word of the line, everything that isn't a known command is ignored
+				skipBlanks();
+				const char* pCommand = pCursor;
+				while (pCursor < pLineEnd && !isBlank(*pCursor))
+					++pCursor;
+				const std::string_view sCommand{ pCommand, size_t(pCursor - pCommand) };
+
+				if (sCommand == "v")
 				{
 					//Vertex
-					float x, y, z;
-					file >> x >> y >> z;
+					const float x = readFloat();
+					const float y = readFloat();
+					const float z = readFloat();
 
-					positions.emplace_back(x, y, z);
+					chunk.positions.emplace_back(x, y, z);
 				}
 				else if (sCommand == "vt")
 				{
 					// Vertex TexCoord
-					float u, v;
-					file >> u >> v;
-					UVs.emplace_back(u, 1 - v);
+					const float u = readFloat();
+					const float v = readFloat();
+					chunk.UVs.emplace_back(u, 1 - v);
 				}
 				else if (sCommand == "vn")
 				{
 					// Vertex Normal
-					float x, y, z;
-					file >> x >> y >> z;
+					const float x = readFloat();
+					const float y = readFloat();
+					const float z = readFloat();
 
-					normals.emplace_back(x, y, z);
+					chunk.normals.emplace_back(x, y, z);
 				}
 				else if (sCommand == "f")
 				{
-					//if a face is read:
-					//construct the 3 vertices, add them to the vertex array
-					//add three indices to the index array
-					//add the material index as attibute to the attribute array
-					//
-					// Faces or triangles
-					Vertex vertex{};
-					size_t iPosition, iTexCoord, iNormal;
-
-					uint32_t tempIndices[3];
+					// Faces or triangles, only the first 3 corners
 					for (size_t iFace = 0; iFace < 3; iFace++)
 					{
+						uint32_t iTexCoord{};
+						uint32_t iNormal{};
+
 						// OBJ format uses 1-based arrays
-						file >> iPosition;
-						vertex.position = positions[iPosition - 1];
+						const uint32_t iPosition = readIndex();
 
-						if ('/' == file.peek())//is next in buffer ==  '/' ?
+						if ('/' == peek())
 						{
-							file.ignore();//read and ignore one element ('/')
+							++pCursor;
 
-							if ('/' != file.peek())
+							if ('/' != peek())
 							{
 								// Optional texture coordinate
-								file >> iTexCoord;
-								vertex.uv = UVs[iTexCoord - 1];
+								iTexCoord = readIndex();
 							}
 
-							if ('/' == file.peek())
+							if ('/' == peek())
 							{
-								file.ignore();
+								++pCursor;
 
 								// Optional vertex normal
-								file >> iNormal;
-								vertex.normal = normals[iNormal - 1];
+								iNormal = readIndex();
 							}
 						}
 
-						vertices.push_back(vertex);
-						tempIndices[iFace] = uint32_t(vertices.size()) - 1;
-						//indices.push_back(uint32_t(vertices.size()) - 1);
+						chunk.cornerPositions.push_back(iPosition);
+						chunk.cornerUVs.push_back(iTexCoord);
+						chunk.cornerNormals.push_back(iNormal);
 					}
+				}
 
-					indices.push_back(tempIndices[0]);
-					if (flipAxisAndWinding) 
-					{
-						indices.push_back(tempIndices[2]);
-						indices.push_back(tempIndices[1]);
-					}
-					else
-					{
-						indices.push_back(tempIndices[1]);
-						indices.push_back(tempIndices[2]);
-					}
+				//skip the rest of the line
+				pCursor = pLineEnd + 1;
+			}
+		}
+
+		//Just parses vertices and indices. With a thread pool the file is parsed in line aligned chunks on
+		//all of its threads, the result is the same either way
+		static bool ParseOBJ(const std::string& filename, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, bool flipAxisAndWinding = true, ThreadPool* pThreadPool = nullptr)
+		{
+#ifdef DISABLE_OBJ
+
+			//TODO: Enable the code below after uncommenting all the vertex attributes of DataTypes::Vertex
+			// >> Comment/Remove '#define DISABLE_OBJ'
+			assert(false && "OBJ PARSER not enabled! Check the comments in Utils::ParseOBJ");
+
+#else
+
+			// Mapped instead of streamed, the chunks are parsed straight out of the page cache
+			const MappedFile file{ filename };
+			if (!file.IsOpen())
+				return false;
+
+			const auto parallelFor = [pThreadPool](size_t count, const auto& body)
+			{
+				if (pThreadPool)
+				{
+					pThreadPool->ParallelFor(count, body);
+					return;
 				}
-				//read till end of line and ignore all remaining chars
-				file.ignore(1000, '\n');
+
+				for (size_t i{}; i < count; ++i)
+					body(i);
+			};
+
+			const char* const pFileBegin = reinterpret_cast<const char*>(file.GetData());
+			const char* const pFileEnd = pFileBegin + file.GetSize();
+			const size_t threadCount = pThreadPool ? pThreadPool->GetThreadCount() : 1;
+			const size_t chunkCount = std::clamp(file.GetSize() / MinOBJChunkSize, size_t(1), threadCount * OBJChunksPerThread);
+
+			// Even splits, each pushed past the end of the line it lands in
+			std::vector<OBJChunk> chunks(chunkCount);
+			for (size_t i{}; i < chunkCount; ++i)
+			{
+				chunks[i].pBegin = i > 0 ? chunks[i - 1].pEnd : pFileBegin;
+
+				const char* pSplit = std::max(pFileBegin + file.GetSize() * (i + 1) / chunkCount, chunks[i].pBegin);
+				const char* pLineEnd = i + 1 < chunkCount ? static_cast<const char*>(memchr(pSplit, '\n', size_t(pFileEnd - pSplit))) : nullptr;
+				chunks[i].pEnd = pLineEnd ? pLineEnd + 1 : pFileEnd;
 			}
 
-			//Cheap Tangent Calculations
-			for (uint32_t i = 0; i < indices.size(); i += 3)
+			parallelFor(chunkCount, [&chunks](size_t i) { ParseOBJChunk(chunks[i]); });
+
+			// Prefix sums of the counts give every chunk its place in the merged arrays
+			size_t positionCount{};
+			size_t UVCount{};
+			size_t normalCount{};
+			size_t faceCount{};
+			for (OBJChunk& chunk : chunks)
 			{
-				uint32_t index0 = indices[i];
-				uint32_t index1 = indices[size_t(i) + 1];
-				uint32_t index2 = indices[size_t(i) + 2];
-
-				const Vector3& p0 = vertices[index0].position;
-				const Vector3& p1 = vertices[index1].position;
-				const Vector3& p2 = vertices[index2].position;
-				const Vector2& uv0 = vertices[index0].uv;
-				const Vector2& uv1 = vertices[index1].uv;
-				const Vector2& uv2 = vertices[index2].uv;
-
-				const Vector3 edge0 = p1 - p0;
-				const Vector3 edge1 = p2 - p0;
-				const Vector2 diffX = Vector2(uv1.x - uv0.x, uv2.x - uv0.x);
-				const Vector2 diffY = Vector2(uv1.y - uv0.y, uv2.y - uv0.y);
-				float r = 1.f / Vector2::Cross(diffX, diffY);
-
-				Vector3 tangent = (edge0 * diffY.y - edge1 * diffY.x) * r;
-				vertices[index0].tangent += tangent;
-				vertices[index1].tangent += tangent;
-				vertices[index2].tangent += tangent;
+				chunk.positionOffset = positionCount;
+				chunk.UVOffset = UVCount;
+				chunk.normalOffset = normalCount;
+				chunk.faceOffset = faceCount;
+
+				positionCount += chunk.positions.size();
+				UVCount += chunk.UVs.size();
+				normalCount += chunk.normals.size();
+				faceCount += chunk.cornerPositions.size() / 3;
 			}
 
-			//Fix the tangents per vertex now because we accumulated
-			for (auto& v : vertices)
+			std::vector<Vector3> positions(positionCount);
+			std::vector<Vector2> UVs(UVCount);
+			std::vector<Vector3> normals(normalCount);
+
+			parallelFor(chunkCount, [&](size_t i)
+			{
+				OBJChunk& chunk = chunks[i];
+				std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + chunk.positionOffset);
+				std::copy(chunk.UVs.begin(), chunk.UVs.end(), UVs.begin() + chunk.UVOffset);
+				std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + chunk.normalOffset);
+			});
+
+			vertices.assign(faceCount * 3, Vertex{});
+			indices.assign(faceCount * 3, 0);
+
+			// Every face gets 3 vertices of its own, so faces resolve and get their tangents independently
+			parallelFor(chunkCount, [&](size_t i)
 			{
-				v.tangent = Vector3::Reject(v.tangent, v.normal).Normalized();
+				const OBJChunk& chunk = chunks[i];
 
-				if(flipAxisAndWinding)
+				for (size_t iFace{}; iFace < chunk.cornerPositions.size() / 3; ++iFace)
 				{
-					v.position.z *= -1.f;
-					v.normal.z *= -1.f;
-					v.tangent.z *= -1.f;
-				}
+					//construct the 3 vertices, a corner without a uv or normal keeps the one of the corner before it
+					const size_t firstIndex = (chunk.faceOffset + iFace) * 3;
+					Vertex vertex{};
 
-			}
+					for (size_t iCorner = 0; iCorner < 3; iCorner++)
+					{
+						const size_t corner = iFace * 3 + iCorner;
+
+						vertex.position = positions[chunk.cornerPositions[corner] - 1];
+						if (chunk.cornerUVs[corner] != 0)
+							vertex.uv = UVs[chunk.cornerUVs[corner] - 1];
+						if (chunk.cornerNormals[corner] != 0)
+							vertex.normal = normals[chunk.cornerNormals[corner] - 1];
+
+						vertices[firstIndex + iCorner] = vertex;
+					}
+
+					indices[firstIndex] = uint32_t(firstIndex);
+					if (flipAxisAndWinding)
+					{
+						indices[firstIndex + 1] = uint32_t(firstIndex + 2);
+						indices[firstIndex + 2] = uint32_t(firstIndex + 1);
+					}
+					else
+					{
+						indices[firstIndex + 1] = uint32_t(firstIndex + 1);
+						indices[firstIndex + 2] = uint32_t(firstIndex + 2);
+					}
+
+					//Cheap Tangent Calculations
+					uint32_t index0 = indices[firstIndex];
+					uint32_t index1 = indices[firstIndex + 1];
+					uint32_t index2 = indices[firstIndex + 2];
+
+					const Vector3& p0 = vertices[index0].position;
+					const Vector3& p1 = vertices[index1].position;
+					const Vector3& p2 = vertices[index2].position;
+					const Vector2& uv0 = vertices[index0].uv;
+					const Vector2& uv1 = vertices[index1].uv;
+					const Vector2& uv2 = vertices[index2].uv;
+
+					const Vector3 edge0 = p1 - p0;
+					const Vector3 edge1 = p2 - p0;
+					const Vector2 diffX = Vector2(uv1.x - uv0.x, uv2.x - uv0.x);
+					const Vector2 diffY = Vector2(uv1.y - uv0.y, uv2.y - uv0.y);
+					float r = 1.f / Vector2::Cross(diffX, diffY);
+
+					Vector3 tangent = (edge0 * diffY.y - edge1 * diffY.x) * r;
+					vertices[index0].tangent += tangent;
+					vertices[index1].tangent += tangent;
+					vertices[index2].tangent += tangent;
+
+					//Fix the tangents per vertex now that the face's own is in
+					for (size_t iCorner = 0; iCorner < 3; iCorner++)
+					{
+						Vertex& v = vertices[firstIndex + iCorner];
+						v.tangent = Vector3::Reject(v.tangent, v.normal).Normalized();
+
+						if (flipAxisAndWinding)
+						{
+							v.position.z *= -1.f;
+							v.normal.z *= -1.f;
+							v.tangent.z *= -1.f;
+						}
+					}
+				}
+			});
 
 			return true;
 #endif
 		}
+
+		static void CalculateBounds(const std::vector<Vertex>& vertices, Vector3& minBounds, Vector3& maxBounds)
+		{
+			if (vertices.empty())
+			{
+				minBounds = maxBounds = Vector3::Zero;
+				return;
+			}
+
+			minBounds = maxBounds = vertices[0].position;
+			for (const auto& v : vertices)
+			{
+				minBounds = { std::min(minBounds.x, v.position.x), std::min(minBounds.y, v.position.y), std::min(minBounds.z, v.position.z) };
+				maxBounds = { std::max(maxBounds.x, v.position.x), std::max(maxBounds.y, v.position.y), std::max(maxBounds.z, v.position.z) };
+			}
+		}
 #pragma warning(pop)
 	}
 }
\ No newline at end of file
@@ -0,0 +1,160 @@
+#include "VertexPacking.h"
+
+#include <algorithm>
+#include <immintrin.h>
+
+namespace dae
+{
+	namespace VertexPacking
+	{
+		namespace
+		{
+			uint32_t PackSnorm16x2(float x, float y)
+			{
+				const auto snorm = [](float v)
+				{
+					return static_cast<uint16_t>(static_cast<int16_t>(std::lround(Clamp(v, -1.f, 1.f) * SnormSteps)));
+				};
+
+				return uint32_t(snorm(x)) | (uint32_t(snorm(y)) << 16);
+			}
+
+			uint16_t Quantize(float v, float min, float max)
+			{
+				const float extent = max - min;
+				return extent > 0.f ? static_cast<uint16_t>(std::lround(Saturate((v - min) / extent) * PositionSteps)) : 0;
+			}
+
+			float Dequantize(uint16_t q, float min, float max)
+			{
+				return min + q * ((max - min) / PositionSteps);
+			}
+		}
+
+		uint32_t EncodeOctahedral(const Vector3& v)
+		{
+			const float length = std::abs(v.x) + std::abs(v.y) + std::abs(v.z);
+			if (length <= 0.f)
+			{
+				return PackSnorm16x2(0.f, 0.f);
+			}
+
+			float x = v.x / length;
+			float y = v.y / length;
+
+			// Fold the lower hemisphere over the diagonals
+			if (v.z < 0.f)
+			{
+				const float foldedX = (1.f - std::abs(y)) * (x >= 0.f ? 1.f : -1.f);
+				const float foldedY = (1.f - std::abs(x)) * (y >= 0.f ? 1.f : -1.f);
+				x = foldedX;
+				y = foldedY;
+			}
+
+			return PackSnorm16x2(x, y);
+		}
+
+		Vector3 DecodeOctahedral(uint32_t encoded)
+		{
+			const float x = static_cast<int16_t>(encoded & 0xFFFF) / SnormSteps;
+			const float y = static_cast<int16_t>(encoded >> 16) / SnormSteps;
+
+			Vector3 v{ x, y, 1.f - std::abs(x) - std::abs(y) };
+			const float t = std::max(-v.z, 0.f);
+			v.x += v.x >= 0.f ? -t : t;
+			v.y += v.y >= 0.f ? -t : t;
+
+			return v.Normalized();
+		}
+
+		uint16_t FloatToHalf(float value)
+		{
+			return static_cast<uint16_t>(_cvtss_sh(value, _MM_FROUND_TO_NEAREST_INT));
+		}
+
+		float HalfToFloat(uint16_t value)
+		{
+			return _cvtsh_ss(value);
+		}
+
+		uint32_t PackColor(const ColorRGB& color)
+		{
+			const auto unorm = [](float v) { return static_cast<uint32_t>(std::lround(Saturate(v) * 255.f)); };
+			return unorm(color.r) | (unorm(color.g) << 8) | (unorm(color.b) << 16) | (255u << 24);
+		}
+
+		ColorRGB UnpackColor(uint32_t color)
+		{
+			return { (color & 0xFF) / 255.f, ((color >> 8) & 0xFF) / 255.f, ((color >> 16) & 0xFF) / 255.f };
+		}
+
+		PackedVertex Pack(const Vertex& vertex, const Vector3& minBounds, const Vector3& maxBounds)
+		{
+			PackedVertex packed{};
+
+			packed.normal = EncodeOctahedral(vertex.normal);
+			packed.tangent = EncodeOctahedral(vertex.tangent);
+
+			packed.position[0] = Quantize(vertex.position.x, minBounds.x, maxBounds.x);
+			packed.position[1] = Quantize(vertex.position.y, minBounds.y, maxBounds.y);
+			packed.position[2] = Quantize(vertex.position.z, minBounds.z, maxBounds.z);
+
+			packed.uv[0] = FloatToHalf(vertex.uv.x);
+			packed.uv[1] = FloatToHalf(vertex.uv.y);
+
+			return packed;
+		}
+
+		Vertex Unpack(const PackedVertex& vertex, uint32_t color, const Vector3& minBounds, const Vector3& maxBounds)
+		{
+			Vertex unpacked{};
+
+			unpacked.position = {
+				Dequantize(vertex.position[0], minBounds.x, maxBounds.x),
+				Dequantize(vertex.position[1], minBounds.y, maxBounds.y),
+				Dequantize(vertex.position[2], minBounds.z, maxBounds.z)
+			};
+			unpacked.color = UnpackColor(color);
+			unpacked.uv = { HalfToFloat(vertex.uv[0]), HalfToFloat(vertex.uv[1]) };
+			unpacked.normal = DecodeOctahedral(vertex.normal);
+			unpacked.tangent = DecodeOctahedral(vertex.tangent);
+
+			return unpacked;
+		}
+
+		void PackVertices(const std::vector<Vertex>& vertices, const Vector3& minBounds, const Vector3& maxBounds, PackedVertexStream& stream)
+		{
+			stream.vertices.clear();
+			stream.vertices.reserve(vertices.size());
+			stream.colors.clear();
+
+			bool isWhite = true;
+			for (const auto& v : vertices)
+			{
+				stream.vertices.emplace_back(Pack(v, minBounds, maxBounds));
+				isWhite &= PackColor(v.color) == 0xFFFFFFFF;
+			}
+
+			if (!isWhite)
+			{
+				stream.colors.reserve(vertices.size());
+				for (const auto& v : vertices)
+				{
+					stream.colors.emplace_back(PackColor(v.color));
+				}
+			}
+		}
+
+		void PackMesh(Mesh& mesh)
+		{
+			PackVertices(mesh.vertices, mesh.minBounds, mesh.maxBounds, mesh.packedVertices);
+			mesh.vertices = {};
+
+			for (auto& lod : mesh.lods)
+			{
+				PackVertices(lod.vertices, mesh.minBounds, mesh.maxBounds, lod.packedVertices);
+				lod.vertices = {};
+			}
+		}
+	}
+}
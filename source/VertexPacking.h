@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "DataTypes.h"
+
+namespace dae
+{
+	namespace VertexPacking
+	{
+		constexpr float PositionSteps = 65535.f;
+		constexpr float SnormSteps = 32767.f;
+
+		uint32_t EncodeOctahedral(const Vector3& v);
+		Vector3 DecodeOctahedral(uint32_t encoded);
+
+		uint16_t FloatToHalf(float value);
+		float HalfToFloat(uint16_t value);
+
+		uint32_t PackColor(const ColorRGB& color);
+		ColorRGB UnpackColor(uint32_t color);
+
+		PackedVertex Pack(const Vertex& vertex, const Vector3& minBounds, const Vector3& maxBounds);
+		Vertex Unpack(const PackedVertex& vertex, uint32_t color, const Vector3& minBounds, const Vector3& maxBounds);
+
+		void PackVertices(const std::vector<Vertex>& vertices, const Vector3& minBounds, const Vector3& maxBounds, PackedVertexStream& stream);
+		// Packs the base vertices and every LOD against the mesh bounds, then frees the float vertices. The
+		// packed streams carry everything the renderer reads, so the mesh only keeps one copy
+		void PackMesh(Mesh& mesh);
+	}
+}
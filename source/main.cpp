@@ -6,6 +6,7 @@
 
 //Standard includes
 #include <iostream>
+#include <string>
 
 //Project includes
 #include "Timer.h"
@@ -21,9 +22,8 @@ void ShutDown(SDL_Window* pWindow)
 
 int main(int argc, char* args[])
 {
-	//Unreferenced parameters
-	(void)argc;
-	(void)args;
+	// --benchmark prints the accuracy and speed reports once and exits instead of running the loop
+	const bool runBenchmarks = argc > 1 && std::string{ args[1] } == "--benchmark";
 
 	//Create window + surfaces
 	SDL_Init(SDL_INIT_VIDEO);
@@ -44,6 +44,15 @@ int main(int argc, char* args[])
 	const auto pTimer = new Timer();
 	const auto pRenderer = new Renderer(pWindow);
 
+	if (runBenchmarks)
+	{
+		pRenderer->PrintBenchmarks();
+		delete pRenderer;
+		delete pTimer;
+		ShutDown(pWindow);
+		return 0;
+	}
+
 	//Start loop
 	pTimer->Start();
 	float printTimer = 0.f;
@@ -63,6 +72,18 @@ int main(int argc, char* args[])
 			case SDL_KEYUP:
 				if (e.key.keysym.scancode == SDL_SCANCODE_X)
 					takeScreenshot = true;
+				else if (e.key.keysym.scancode == SDL_SCANCODE_M)
+					pRenderer->ToggleMipmaps();
+				else if (e.key.keysym.scancode == SDL_SCANCODE_N)
+					pRenderer->CycleTextureFilter();
+				else if (e.key.keysym.scancode == SDL_SCANCODE_P)
+					pRenderer->TogglePackedMaterials();
+				else if (e.key.keysym.scancode == SDL_SCANCODE_F1)
+					pRenderer->ToggleHdr();
+				else if (e.key.keysym.scancode == SDL_SCANCODE_F2)
+					pRenderer->CycleToneMapper();
+				else if (e.key.keysym.scancode == SDL_SCANCODE_F3)
+					pRenderer->ToggleShadows();
 				else if (e.key.keysym.scancode == SDL_SCANCODE_F4)
 					pRenderer->ToggleDepthBufferVisualization();
 				else if (e.key.keysym.scancode == SDL_SCANCODE_F5)
@@ -71,6 +92,14 @@ int main(int argc, char* args[])
 					pRenderer->ToggleNormalMap();
 				else if (e.key.keysym.scancode == SDL_SCANCODE_F7)
 					pRenderer->CycleLightingMode();
+				else if (e.key.keysym.scancode == SDL_SCANCODE_F8)
+					pRenderer->ToggleLOD();
+				else if (e.key.keysym.scancode == SDL_SCANCODE_F9)
+					pRenderer->ToggleTraffic();
+				else if (e.key.keysym.scancode == SDL_SCANCODE_F11)
+					pRenderer->CycleSpecularPower();
+				else if (e.key.keysym.scancode == SDL_SCANCODE_F12)
+					pRenderer->ToggleNightLights();
 				break;
 			}
 		}